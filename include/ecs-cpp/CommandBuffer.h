@@ -0,0 +1,199 @@
+//
+// Created by Stefan Annell on 2024-04-20.
+//
+
+#pragma once
+
+#include <vector>
+#include <tuple>
+#include <optional>
+#include <cstdint>
+#include <type_traits>
+#include "EcsCpp.h"
+
+namespace ecs {
+    /**
+     * CommandBuffer
+     * Records entities and components to add and remove, and
+     * applies them to a ECSManager later. Adding or removing while
+     * looping over a system moves the component arrays under the
+     * loop, recording the changes and applying them after the loop
+     * avoids that.
+     * A buffer is not thread safe, use one buffer per thread and
+     * apply them one after the other.
+     * ecs::CommandBuffer<decltype(ecs)> commands;
+     * for (auto [id, health]: ecs.GetSystem<ecs::Entity, const Health>()) {
+     *     if (health.value <= 0) {
+     *         commands.RemoveEntity(id);
+     *     }
+     * }
+     * commands.Apply(ecs);
+     * @tparam TManager the ECSManager the commands are applied to.
+     */
+    template<typename TManager>
+    class CommandBuffer;
+
+    template<typename... TComponents>
+    class CommandBuffer<ECSManager<TComponents...>> {
+    private:
+        using TECSManager = ECSManager<TComponents...>;
+        using ComponentValues = std::tuple<std::vector<TComponents>...>;
+        static constexpr size_t NotCreated = SIZE_MAX;
+
+        struct Command;
+        using ApplyFunction = void (*)(CommandBuffer &, TECSManager &, std::vector<EntityID> &, const Command &);
+
+        /**
+         * A recorded change. The target is either a existing entity
+         * or the n:th entity created by the buffer, value indexes
+         * the recorded components of the type.
+         */
+        struct Command {
+            ApplyFunction apply;
+            EntityID entity;
+            size_t created = NotCreated;
+            size_t value = 0;
+        };
+
+    public:
+        /**
+         * Records a new entity with the given components.
+         * @param components the components of the entity.
+         */
+        template<typename... TEntityComponents>
+        requires (TypeIn<TEntityComponents, TComponents...> && ...)
+        void BuildEntity(TEntityComponents &&... components) {
+            auto created = nrCreated++;
+            commands.push_back(Command{&ApplyAddEntity, EntityID(), created});
+            (Record<std::remove_cvref_t<TEntityComponents>>(EntityID(), created, std::forward<TEntityComponents>(components)), ...);
+        }
+
+        /**
+         * Records a component to add to the entity, applying it
+         * replaces the component if the entity already has it.
+         * @param entityId the entity.
+         * @param component the component.
+         */
+        template<typename TComponent>
+        requires TypeIn<TComponent, TComponents...>
+        void Add(const EntityID &entityId, TComponent component) {
+            Record<TComponent>(entityId, NotCreated, std::move(component));
+        }
+
+        /**
+         * Records a component to remove from the entity, nothing
+         * happens if the entity does not have it when applied.
+         * @param entityId the entity.
+         */
+        template<typename TComponent>
+        requires TypeIn<TComponent, TComponents...>
+        void Remove(const EntityID &entityId) {
+            commands.push_back(Command{&ApplyRemove<TComponent>, entityId});
+        }
+
+        /**
+         * Records a entity to remove.
+         * @param entityId the entity.
+         */
+        void RemoveEntity(const EntityID &entityId) {
+            commands.push_back(Command{&ApplyRemoveEntity, entityId});
+        }
+
+        /**
+         * Applies the recorded changes in the order they were
+         * recorded and empties the buffer. Entities reserved with
+         * ECSManager::ReserveEntity are committed first, so commands
+         * can be recorded for them. Changes to entities that has
+         * been removed by the time they are applied are skipped.
+         * @param ecs the ECSManager to apply the changes to.
+         * @return std::vector<EntityID> the entities created, in the
+         * order they were recorded.
+         */
+        std::vector<EntityID> Apply(TECSManager &ecs) {
+            std::vector<EntityID> created;
+            created.reserve(nrCreated);
+            ecs.CommitReserved();
+            for (const auto &command: commands) {
+                command.apply(*this, ecs, created, command);
+            }
+            Clear();
+            return created;
+        }
+
+        /**
+         * Drops the recorded changes.
+         */
+        void Clear() {
+            commands.clear();
+            std::apply([](auto &...values) { (values.clear(), ...); }, values);
+            nrCreated = 0;
+        }
+
+        /**
+         * Number of recorded changes.
+         */
+        [[nodiscard]] size_t Size() const {
+            return commands.size();
+        }
+
+        [[nodiscard]] bool Empty() const {
+            return commands.empty();
+        }
+
+    private:
+        template<typename TComponent, typename TValue>
+        void Record(const EntityID &entityId, size_t created, TValue &&component) {
+            auto &recorded = std::get<std::vector<TComponent>>(values);
+            commands.push_back(Command{&ApplyAdd<TComponent>, entityId, created, recorded.size()});
+            recorded.push_back(std::forward<TValue>(component));
+        }
+
+        /**
+         * The entity the command targets, or nullopt if it is not
+         * alive anymore.
+         */
+        static std::optional<EntityID> Target(TECSManager &ecs, const std::vector<EntityID> &created, const Command &command) {
+            auto entityId = command.created == NotCreated ? command.entity : created[command.created];
+            if (!ecs.HasEntity(entityId)) {
+                return std::nullopt;
+            }
+            return entityId;
+        }
+
+        static void ApplyAddEntity(CommandBuffer &, TECSManager &ecs, std::vector<EntityID> &created, const Command &) {
+            created.push_back(ecs.AddEntity());
+        }
+
+        template<typename TComponent>
+        static void ApplyAdd(CommandBuffer &buffer, TECSManager &ecs, std::vector<EntityID> &created, const Command &command) {
+            auto entityId = Target(ecs, created, command);
+            if (!entityId) {
+                return;
+            }
+            auto &component = std::get<std::vector<TComponent>>(buffer.values)[command.value];
+            if (ecs.template Has<TComponent>(*entityId)) {
+                ecs.template Get<TComponent>(*entityId) = std::move(component);
+            } else {
+                ecs.Add(*entityId, std::move(component));
+            }
+        }
+
+        template<typename TComponent>
+        static void ApplyRemove(CommandBuffer &, TECSManager &ecs, std::vector<EntityID> &created, const Command &command) {
+            auto entityId = Target(ecs, created, command);
+            if (entityId && ecs.template Has<TComponent>(*entityId)) {
+                ecs.template Remove<TComponent>(*entityId);
+            }
+        }
+
+        static void ApplyRemoveEntity(CommandBuffer &, TECSManager &ecs, std::vector<EntityID> &created, const Command &command) {
+            if (auto entityId = Target(ecs, created, command)) {
+                ecs.RemoveEntity(*entityId);
+            }
+        }
+
+        std::vector<Command> commands;
+        ComponentValues values;
+        size_t nrCreated = 0;
+    };
+}
@@ -0,0 +1,478 @@
+//
+// Created by Stefan Annell on 2024-01-20.
+//
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <type_traits>
+#include <stdexcept>
+#include <new>
+#include <algorithm>
+
+namespace ecs {
+    /**
+     * Size of a cache line, the alignment of the dense component
+     * arrays.
+     */
+    static constexpr size_t CacheLineSize = 64;
+
+    /**
+     * CacheLineAllocator
+     * Allocates memory starting on a cache line, so a range of
+     * slots that is a multiple of CacheLineSize starts and ends on
+     * a cache line boundary in every dense component array. Types
+     * aligned to more than a cache line get their own alignment.
+     * @tparam T the allocated type.
+     */
+    template<typename T>
+    struct CacheLineAllocator {
+        using value_type = T;
+        static constexpr std::align_val_t Alignment{std::max(CacheLineSize, alignof(T))};
+
+        CacheLineAllocator() = default;
+
+        template<typename U>
+        constexpr CacheLineAllocator(const CacheLineAllocator<U> &) noexcept {}
+
+        [[nodiscard]] T *allocate(size_t n) {
+            return static_cast<T *>(::operator new(n * sizeof(T), Alignment));
+        }
+
+        void deallocate(T *pointer, size_t /*n*/) noexcept {
+            ::operator delete(pointer, Alignment);
+        }
+
+        template<typename U>
+        friend constexpr bool operator==(const CacheLineAllocator &, const CacheLineAllocator<U> &) noexcept {
+            return true;
+        }
+    };
+
+    /**
+     * Tick
+     * The world clock of a ECSManager, components are stamped with
+     * the tick they were added and last mutably accessed at.
+     */
+    using Tick = uint32_t;
+
+    /**
+     * Per component ticks, on a cache line like the dense arrays.
+     */
+    using TickArray = std::vector<Tick, CacheLineAllocator<Tick>>;
+
+    /**
+     * StorageType
+     * How the data of a component type is laid out in memory.
+     * Dense: one value per entity slot, indexed by the slot.
+     * Sparse: a sparse set, memory scales with the number of
+     * entities that actually has the component.
+     * Tag: no storage at all, only tracks if the entity has the
+     * component. Only for empty types.
+     * Singleton: a single instance resource, at most one entity
+     * can have the component at a time.
+     */
+    enum class StorageType {
+        Dense,
+        Sparse,
+        Tag,
+        Singleton,
+    };
+
+    /**
+     * StoragePolicy
+     * Customization point to pick the storage of a component type,
+     * defaults to Tag for empty types and Dense for everything
+     * else. Specialize it to change the storage:
+     * template<> struct ecs::StoragePolicy<Big> {
+     *     static constexpr ecs::StorageType value = ecs::StorageType::Sparse;
+     * };
+     * @tparam TComponent the component type.
+     */
+    template<typename TComponent>
+    struct StoragePolicy {
+        static constexpr StorageType value = std::is_empty_v<TComponent> ? StorageType::Tag : StorageType::Dense;
+    };
+
+    /**
+     * DenseStorage
+     * Stores one component value per entity slot, accessed directly
+     * by the slot index. Best for components most entities have.
+     * The array starts on a cache line. The added and changed ticks
+     * are kept per slot as well.
+     * @tparam TComponent the component type.
+     */
+    template<typename TComponent>
+    class DenseStorage {
+    public:
+        void Resize(size_t nrSlots) {
+            data.resize(nrSlots);
+            added.resize(nrSlots);
+            changed.resize(nrSlots);
+        }
+
+        void Reserve(size_t nrSlots) {
+            data.reserve(nrSlots);
+            added.reserve(nrSlots);
+            changed.reserve(nrSlots);
+        }
+
+        void Insert(size_t slot, TComponent component, Tick tick = 0) {
+            data[slot] = std::move(component);
+            added[slot] = tick;
+            changed[slot] = tick;
+        }
+
+        void Erase(size_t /*slot*/) {}
+
+        [[nodiscard]] TComponent &Get(size_t slot) {
+            return data[slot];
+        }
+
+        [[nodiscard]] const TComponent &Get(size_t slot) const {
+            return data[slot];
+        }
+
+        [[nodiscard]] TComponent *Data() {
+            return data.data();
+        }
+
+        [[nodiscard]] const TComponent *Data() const {
+            return data.data();
+        }
+
+        [[nodiscard]] Tick GetAdded(size_t slot) const {
+            return added[slot];
+        }
+
+        [[nodiscard]] Tick GetChanged(size_t slot) const {
+            return changed[slot];
+        }
+
+        void SetChanged(size_t slot, Tick tick) {
+            changed[slot] = tick;
+        }
+
+        /**
+         * The changed ticks indexed by slot, for the iteration
+         * loops.
+         */
+        [[nodiscard]] Tick *ChangedData() {
+            return changed.data();
+        }
+
+    private:
+        std::vector<TComponent, CacheLineAllocator<TComponent>> data;
+        TickArray added;
+        TickArray changed;
+    };
+
+    /**
+     * SparseStorage
+     * A sparse set, the components are packed in a dense array
+     * and a paged sparse index maps entity slots into it. Pages of
+     * the index are only allocated for slot ranges that has been
+     * given the component, so memory scales with the number of
+     * components rather than the number of entities.
+     * Removal swaps the last component into the hole, so the
+     * dense array stays packed but does not keep slot order.
+     * The ticks are packed along with the components.
+     * @tparam TComponent the component type.
+     */
+    template<typename TComponent>
+    class SparseStorage {
+    public:
+        static constexpr size_t PageSize = 4096;
+
+        void Resize(size_t /*nrSlots*/) {}
+
+        void Insert(size_t slot, TComponent component, Tick tick = 0) {
+            SetIndex(slot, dense.size());
+            dense.push_back(std::move(component));
+            slots.push_back(slot);
+            added.push_back(tick);
+            changed.push_back(tick);
+        }
+
+        void Erase(size_t slot) {
+            auto index = GetIndex(slot);
+            if (index != dense.size() - 1) {
+                dense[index] = std::move(dense.back());
+                slots[index] = slots.back();
+                added[index] = added.back();
+                changed[index] = changed.back();
+                SetIndex(slots[index], index);
+            }
+            dense.pop_back();
+            slots.pop_back();
+            added.pop_back();
+            changed.pop_back();
+        }
+
+        [[nodiscard]] TComponent &Get(size_t slot) {
+            return dense[GetIndex(slot)];
+        }
+
+        [[nodiscard]] const TComponent &Get(size_t slot) const {
+            return dense[GetIndex(slot)];
+        }
+
+        [[nodiscard]] Tick GetAdded(size_t slot) const {
+            return added[GetIndex(slot)];
+        }
+
+        [[nodiscard]] Tick GetChanged(size_t slot) const {
+            return changed[GetIndex(slot)];
+        }
+
+        void SetChanged(size_t slot, Tick tick) {
+            changed[GetIndex(slot)] = tick;
+        }
+
+        /**
+         * The entity slots of the packed components, in the same
+         * order as the components.
+         */
+        [[nodiscard]] const std::vector<size_t> &Slots() const {
+            return slots;
+        }
+
+        [[nodiscard]] size_t Size() const {
+            return dense.size();
+        }
+
+    private:
+        using Index = uint32_t;
+
+        [[nodiscard]] size_t GetIndex(size_t slot) const {
+            return pages[slot / PageSize][slot % PageSize];
+        }
+
+        void SetIndex(size_t slot, size_t index) {
+            auto page = slot / PageSize;
+            if (page >= pages.size()) {
+                pages.resize(page + 1);
+            }
+            if (pages[page].empty()) {
+                pages[page].resize(PageSize);
+            }
+            pages[page][slot % PageSize] = static_cast<Index>(index);
+        }
+
+        std::vector<std::vector<Index>> pages;
+        std::vector<TComponent> dense;
+        std::vector<size_t> slots;
+        TickArray added;
+        TickArray changed;
+    };
+
+    /**
+     * TagStorage
+     * Stores nothing, a tag only exists as the flag on the entity
+     * that says it has the component. Get hands out the same
+     * instance for every entity, which is fine as it has no state.
+     * Having no state there is nothing to change either, so tags
+     * keep no ticks and can not be filtered on with Changed or
+     * Added.
+     * @tparam TComponent the component type, has to be empty.
+     */
+    template<typename TComponent>
+    class TagStorage {
+        static_assert(std::is_empty_v<TComponent>, "Tag storage can only hold empty types!");
+    public:
+        void Resize(size_t /*nrSlots*/) {}
+
+        void Insert(size_t /*slot*/, TComponent /*component*/, Tick /*tick*/ = 0) {}
+
+        void Erase(size_t /*slot*/) {}
+
+        void SetChanged(size_t /*slot*/, Tick /*tick*/) {}
+
+        [[nodiscard]] TComponent &Get(size_t /*slot*/) {
+            return instance;
+        }
+
+        [[nodiscard]] const TComponent &Get(size_t /*slot*/) const {
+            return instance;
+        }
+
+    private:
+        [[no_unique_address]] TComponent instance{};
+    };
+
+    /**
+     * SingletonStorage
+     * Stores a single instance of the component, owned by at most
+     * one entity at a time. Used for resources like a camera or a
+     * world configuration. As there is one instance there is one
+     * added and one changed tick.
+     * @tparam TComponent the component type.
+     */
+    template<typename TComponent>
+    class SingletonStorage {
+    public:
+        void Resize(size_t /*nrSlots*/) {}
+
+        void Insert(size_t slot, TComponent component, Tick tick = 0) {
+            if (!slots.empty()) {
+                throw std::logic_error("Singleton component already added to another entity!");
+            }
+            instance = std::move(component);
+            slots.push_back(slot);
+            added = tick;
+            changed = tick;
+        }
+
+        void Erase(size_t /*slot*/) {
+            instance = TComponent{};
+            slots.clear();
+        }
+
+        [[nodiscard]] TComponent &Get(size_t /*slot*/) {
+            return instance;
+        }
+
+        [[nodiscard]] const TComponent &Get(size_t /*slot*/) const {
+            return instance;
+        }
+
+        [[nodiscard]] Tick GetAdded(size_t /*slot*/) const {
+            return added;
+        }
+
+        [[nodiscard]] Tick GetChanged(size_t /*slot*/) const {
+            return changed;
+        }
+
+        void SetChanged(size_t /*slot*/, Tick tick) {
+            changed = tick;
+        }
+
+        /**
+         * The slot of the owning entity, empty if no entity has
+         * the component.
+         */
+        [[nodiscard]] const std::vector<size_t> &Slots() const {
+            return slots;
+        }
+
+        [[nodiscard]] size_t Size() const {
+            return slots.size();
+        }
+
+    private:
+        TComponent instance{};
+        std::vector<size_t> slots;
+        Tick added = 0;
+        Tick changed = 0;
+    };
+
+    /**
+     * Storages that keeps a packed list of the slots they hold,
+     * iteration can walk that list instead of all entity slots.
+     */
+    template<typename TStorage>
+    concept SlotListStorage = requires(const TStorage &storage) {
+        { storage.Slots() } -> std::same_as<const std::vector<size_t> &>;
+    };
+
+    template<typename TComponent, StorageType = StoragePolicy<TComponent>::value>
+    struct StorageSelector {
+        using type = DenseStorage<TComponent>;
+    };
+
+    template<typename TComponent>
+    struct StorageSelector<TComponent, StorageType::Sparse> {
+        using type = SparseStorage<TComponent>;
+    };
+
+    template<typename TComponent>
+    struct StorageSelector<TComponent, StorageType::Tag> {
+        using type = TagStorage<TComponent>;
+    };
+
+    template<typename TComponent>
+    struct StorageSelector<TComponent, StorageType::Singleton> {
+        using type = SingletonStorage<TComponent>;
+    };
+
+    template<typename TComponent>
+    using StorageFor = typename StorageSelector<TComponent>::type;
+
+    /**
+     * StorageAccessor
+     * Unchecked access into the storage of a component, used by the
+     * iteration loops. Dense storages are read through a raw pointer
+     * so the base of the array can be kept out of the loop. The
+     * accessor is invalidated when entities are added.
+     * @tparam TComponent the component type, const for read only
+     * access.
+     */
+    template<typename TComponent, StorageType = StoragePolicy<std::remove_const_t<TComponent>>::value>
+    class StorageAccessor {
+        using TStorage = std::conditional_t<std::is_const_v<TComponent>,
+                const StorageFor<std::remove_const_t<TComponent>>,
+                StorageFor<TComponent>>;
+    public:
+        explicit StorageAccessor(TStorage &storage) : storage(&storage) {}
+
+        [[nodiscard]] TComponent &Get(size_t slot) const {
+            return storage->Get(slot);
+        }
+
+    private:
+        TStorage *storage;
+    };
+
+    template<typename TComponent>
+    class StorageAccessor<TComponent, StorageType::Dense> {
+        using TStorage = std::conditional_t<std::is_const_v<TComponent>,
+                const DenseStorage<std::remove_const_t<TComponent>>,
+                DenseStorage<TComponent>>;
+    public:
+        explicit StorageAccessor(TStorage &storage) : data(storage.Data()) {}
+
+        [[nodiscard]] TComponent &Get(size_t slot) const {
+            return data[slot];
+        }
+
+    private:
+        TComponent *data;
+    };
+
+    /**
+     * ChangedStamper
+     * Stamps components as changed at a tick from the iteration
+     * loops. Dense storages are stamped through a raw pointer into
+     * the tick array, like StorageAccessor reads them.
+     * @tparam TComponent the component type.
+     */
+    template<typename TComponent, StorageType = StoragePolicy<TComponent>::value>
+    class ChangedStamper {
+    public:
+        ChangedStamper(StorageFor<TComponent> &storage, Tick tick) : storage(&storage), tick(tick) {}
+
+        void Stamp(size_t slot) const {
+            storage->SetChanged(slot, tick);
+        }
+
+    private:
+        StorageFor<TComponent> *storage;
+        Tick tick;
+    };
+
+    template<typename TComponent>
+    class ChangedStamper<TComponent, StorageType::Dense> {
+    public:
+        ChangedStamper(DenseStorage<TComponent> &storage, Tick tick) : changed(storage.ChangedData()), tick(tick) {}
+
+        void Stamp(size_t slot) const {
+            changed[slot] = tick;
+        }
+
+    private:
+        Tick *changed;
+        Tick tick;
+    };
+}
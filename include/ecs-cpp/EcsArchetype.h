@@ -0,0 +1,489 @@
+//
+// Created by Stefan Annell on 2024-02-03.
+//
+
+#pragma once
+
+#include <vector>
+#include <tuple>
+#include <bitset>
+#include <unordered_map>
+#include <stdexcept>
+#include <concepts>
+#include "EntityID.h"
+#include "EcsUtil.h"
+#include "ComponentStorage.h"
+
+namespace ecs {
+    /**
+     * ArchetypeECSManager
+     * The archetype storage mode of the ECS. It supports the entity
+     * and component part of the ECSManager interface, AddEntity,
+     * BuildEntity, Add, Remove, RemoveEntity, HasEntity, Has, Get,
+     * GetSeveral and Size, but only a mutable GetSystem over plain
+     * components. There are no query terms, const systems,
+     * GetSystemPart, ForEach, ForEachChunk, GetQuery or iteration
+     * over the entities.
+     * Entities with the same set of components, the same signature,
+     * live together in a table where every component is a packed
+     * column. Adding or removing a component moves the entity to the
+     * table of its new signature.
+     *
+     * GetSystem<Component1, ...>() only visits the tables that has all
+     * the requested components, so there is no per entity filtering.
+     * This is the faster mode when systems mostly iterate, while
+     * ECSManager is cheaper for frequent Add/Remove of components.
+     * The StoragePolicy of the components is honoured where it
+     * applies to tables. Tags only exist as a bit in the signature
+     * and never get a column, a singleton can only be owned by one
+     * entity at a time. Dense and sparse components are both kept
+     * as packed columns.
+     * @tparam TComponents list of components that ECS tracks.
+     * TComponents needs to fufill the IsBasicType and NonVoidArgs
+     * concepts.
+     */
+    template<typename... TComponents>
+    requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
+    class ArchetypeECSManager {
+    private:
+        using TECSManager = ArchetypeECSManager<TComponents...>;
+        using Signature = std::bitset<sizeof...(TComponents)>;
+
+        template<typename TComponent>
+        using ComponentColumn = std::vector<TComponent>;
+        using ComponentColumns = std::tuple<ComponentColumn<TComponents>...>;
+
+        /**
+         * Archetype
+         * A table of all entities that has exactly the components in
+         * the signature. Row n of every column belongs to entities[n],
+         * columns of tags and components outside of the signature
+         * stay empty.
+         */
+        struct Archetype {
+            Signature signature;
+            std::vector<EntityID> entities;
+            ComponentColumns columns{};
+        };
+
+        /**
+         * Record
+         * Where the entity in a slot lives, the id holds the current
+         * generation of the slot.
+         */
+        struct Record {
+            size_t archetype = 0;
+            size_t row = 0;
+            bool active = false;
+            EntityID id = EntityID(0);
+        };
+
+        /**
+         * SystemIterator
+         * A iterator that loops over the rows of the matching tables.
+         * @tparam TSystemComponents list of components that
+         * iterator tracks.
+         */
+        template<typename... TSystemComponents>
+        struct SystemIterator {
+        public:
+            [[maybe_unused]] SystemIterator(TECSManager &ecs, const std::vector<size_t> &tables, size_t table) : ecs(ecs), tables(&tables), table(table) {
+                SkipEmptyTables();
+            }
+
+            auto operator*() const {
+                auto &archetype = ecs.archetypes[(*tables)[table]];
+                return std::forward_as_tuple(GetValue<TSystemComponents>(archetype, row)...);
+            }
+
+            SystemIterator &operator++() {
+                row++;
+                SkipEmptyTables();
+                return *this;
+            }
+
+            friend bool operator==(const SystemIterator &a, const SystemIterator &b) { return a.table == b.table && a.row == b.row; };
+
+            friend bool operator!=(const SystemIterator &a, const SystemIterator &b) { return !(a == b); };
+
+        private:
+            void SkipEmptyTables() {
+                while (table < tables->size() && row >= ecs.archetypes[(*tables)[table]].entities.size()) {
+                    table++;
+                    row = 0;
+                }
+            }
+
+            TECSManager &ecs;
+            const std::vector<size_t> *tables;
+            size_t table = 0;
+            size_t row = 0;
+        };
+
+        /**
+         * System
+         * Creates SystemIterators over the tables that matches the
+         * components.
+         * The lifetime of a System needs to be shorter then
+         * its underlying ecs as it stores a reference to it.
+         * @tparam TSystemComponents components to filter on.
+         */
+        template<typename... TSystemComponents>
+        struct System {
+        private:
+            using TSystemIterator = SystemIterator<TSystemComponents...>;
+        public:
+            System(TECSManager &ecs, const std::vector<size_t> &tables) : ecs(ecs), tables(tables) {}
+
+            [[nodiscard]] TSystemIterator begin() const { return TSystemIterator(ecs, tables, 0); }
+
+            [[nodiscard]] TSystemIterator end() const { return TSystemIterator(ecs, tables, tables.size()); }
+
+        private:
+            TECSManager &ecs;
+            const std::vector<size_t> &tables;
+        };
+
+    public:
+        ArchetypeECSManager() {
+            archetypes.push_back({});
+            archetypeIndex[Signature{}] = 0;
+        }
+
+        /**
+         * AddEntity a new entity to the ECS, it starts out in the
+         * table without components.
+         * @return EntityID
+         */
+        [[nodiscard]] EntityID AddEntity() {
+            auto &record = AllocateRecord();
+            Place(record, 0);
+            return record.id;
+        }
+
+        /**
+         * BuildEntity adds a entity and adds in components to the
+         * new entity. The entity is placed directly in the table
+         * of its final signature.
+         * @return EntityID
+         */
+        template<typename... TEntityComponents>
+        requires NonVoidArgs<TEntityComponents...> && (TypeIn<TEntityComponents, TComponents...> && ...)
+        EntityID BuildEntity(TEntityComponents &&... args) {
+            Signature signature;
+            (signature.set(Bit<TEntityComponents>()), ...);
+            if (signature.count() != sizeof...(TEntityComponents)) {
+                throw std::logic_error("Component already added!");
+            }
+            (ValidateSingleton<std::remove_cvref_t<TEntityComponents>>(), ...);
+            auto table = GetArchetype(signature);
+            auto &record = AllocateRecord();
+            Place(record, table);
+            auto &archetype = archetypes[table];
+            ([&] {
+                if constexpr (!IsTag<std::remove_cvref_t<TEntityComponents>>) {
+                    GetColumn<std::remove_cvref_t<TEntityComponents>>(archetype).push_back(std::forward<TEntityComponents>(args));
+                }
+            }(), ...);
+            return record.id;
+        }
+
+        /**
+         * Adds a new component to a entity, moving it to the table
+         * of its new signature.
+         * @tparam TComponent type of the new component.
+         * @param entityId reference to the entity.
+         * @param component the data of the component.
+         */
+        template<typename TComponent>
+        requires TypeIn<TComponent, TComponents...>
+        void Add(const EntityID &entityId, TComponent component) {
+            auto &record = GetRecord(entityId);
+            auto signature = archetypes[record.archetype].signature;
+            if (signature.test(Bit<TComponent>())) {
+                throw std::logic_error("Component already added!");
+            }
+            ValidateSingleton<TComponent>();
+            Move(record, GetArchetype(signature.set(Bit<TComponent>())));
+            if constexpr (!IsTag<TComponent>) {
+                GetColumn<TComponent>(archetypes[record.archetype]).push_back(std::move(component));
+            }
+        }
+
+        /**
+         * Remove a entity from the ECS.
+         * @param entityId reference to the entity.
+         */
+        void RemoveEntity(const EntityID &entityId) {
+            auto &record = GetRecord(entityId);
+            EraseRow(record.archetype, record.row);
+            record.active = false;
+            record.id = record.id.NextGeneration();
+            freeSlots.push_back(record.id.GetId());
+            nrEntities--;
+        }
+
+        /**
+         * Remove a component from a entity, moving it to the table
+         * of its new signature.
+         * @tparam TComponent type of the component to remove
+         * @param entityId reference to the entity.
+         */
+        template<typename TComponent>
+        requires TypeIn<TComponent, TComponents...>
+        void Remove(const EntityID &entityId) {
+            auto &record = GetRecord(entityId);
+            auto signature = archetypes[record.archetype].signature;
+            if (!signature.test(Bit<TComponent>())) {
+                throw std::logic_error("Component not active!");
+            }
+            Move(record, GetArchetype(signature.reset(Bit<TComponent>())));
+        }
+
+        /**
+         * Checks if ecs has the given entity
+         * @param entityId reference to the entity
+         * @return bool if entity is active.
+         */
+        [[nodiscard]] bool HasEntity(const EntityID &entityId) const {
+            ValidateEntityID(entityId);
+            if (entityId.GetId() >= records.size()) {
+                throw std::out_of_range("Trying to access out of bounds!");
+            }
+            return IsAlive(entityId);
+        }
+
+        /**
+         * Checks if the given entity has the components.
+         * @tparam TEntityComponents The type of the components.
+         * @param entityId reference to the entity
+         * @return bool if component is active.
+         */
+        template<typename... TEntityComponents>
+        requires NonVoidArgs<TEntityComponents...> && (TypeIn<TEntityComponents, TComponents...> && ...)
+        [[nodiscard]] bool Has(const EntityID &entityId) const {
+            ValidateEntityID(entityId);
+            if (!IsAlive(entityId)) {
+                return false;
+            }
+            const auto &signature = archetypes[records[entityId.GetId()].archetype].signature;
+            return (signature.test(Bit<TEntityComponents>()) && ...);
+        }
+
+        /**
+         * Returns a reference to the requested component data.
+         * @tparam TComponent the type of the component
+         * @param entityId reference to the entity.
+         * @return TComponent& reference to the component.
+         */
+        template<typename TComponent>
+        requires TypeIn<TComponent, TComponents...>
+        [[nodiscard]] TComponent &Get(const EntityID &entityId) {
+            auto &record = GetRecord(entityId);
+            auto &archetype = archetypes[record.archetype];
+            if (!archetype.signature.test(Bit<TComponent>())) {
+                throw std::invalid_argument("Bad access, component not present on this entity.");
+            }
+            return GetValue<TComponent>(archetype, record.row);
+        }
+
+        /**
+         * A getter to fetch multiple components at once.
+         * @return A tuple with components in the same order as the template arguments.
+         */
+        template<typename... TComponentsRequested>
+        requires NonVoidArgs<TComponentsRequested...> && (TypeIn<TComponentsRequested, TComponents...> && ...)
+        [[nodiscard]] auto GetSeveral(const EntityID &entityId) {
+            return std::forward_as_tuple(Get<TComponentsRequested>(entityId)...);
+        }
+
+        /**
+         * Returns a system over all tables that has the components.
+         * The matching tables are cached per set of components and
+         * kept up to date as new tables are created.
+         * @tparam TSystemComponents the list of components in the system.
+         * @return System<TSystemComponents...> the system of components.
+         */
+        template<typename... TSystemComponents>
+        requires NonVoidArgs<TSystemComponents...> && (TypeIn<TSystemComponents, TComponents...> && ...)
+        [[nodiscard]] System<TSystemComponents...> GetSystem() {
+            Signature mask;
+            (mask.set(Bit<TSystemComponents>()), ...);
+            auto [it, inserted] = matchingTables.try_emplace(mask);
+            if (inserted) {
+                for (size_t table = 0; table < archetypes.size(); table++) {
+                    if ((archetypes[table].signature & mask) == mask) {
+                        it->second.push_back(table);
+                    }
+                }
+            }
+            return System<TSystemComponents...>(*this, it->second);
+        }
+
+        /**
+         * Returns number of entities in ECS
+         * @return size_t
+         */
+        [[nodiscard]] size_t Size() const {
+            return nrEntities;
+        }
+
+        /**
+         * Returns number of tables, one per distinct signature that
+         * has been seen.
+         * @return size_t
+         */
+        [[nodiscard]] size_t ArchetypeCount() const {
+            return archetypes.size();
+        }
+
+    private:
+        template<typename TComponent>
+        static constexpr size_t Bit() {
+            return IndexInPack<TComponent, TComponents...>();
+        }
+
+        template<typename TComponent>
+        static constexpr bool IsTag = StoragePolicy<TComponent>::value == StorageType::Tag;
+
+        /**
+         * Throws if the component is a singleton that another
+         * entity already has.
+         */
+        template<typename TComponent>
+        void ValidateSingleton() const {
+            if constexpr (StoragePolicy<TComponent>::value == StorageType::Singleton) {
+                for (const auto &archetype: archetypes) {
+                    if (archetype.signature.test(Bit<TComponent>()) && !archetype.entities.empty()) {
+                        throw std::logic_error("Singleton component already added to another entity!");
+                    }
+                }
+            }
+        }
+
+        template<typename TComponent>
+        static ComponentColumn<TComponent> &GetColumn(Archetype &archetype) {
+            return std::get<ComponentColumn<TComponent>>(archetype.columns);
+        }
+
+        /**
+         * The component in the given row, tags has no state so they
+         * all share one instance.
+         */
+        template<typename TComponent>
+        static TComponent &GetValue(Archetype &archetype, size_t row) {
+            if constexpr (IsTag<TComponent>) {
+                static_assert(std::is_empty_v<TComponent>, "Tag storage can only hold empty types!");
+                static TComponent tag{};
+                return tag;
+            } else {
+                return GetColumn<TComponent>(archetype)[row];
+            }
+        }
+
+        size_t GetArchetype(const Signature &signature) {
+            auto [it, inserted] = archetypeIndex.try_emplace(signature, archetypes.size());
+            if (inserted) {
+                archetypes.push_back(Archetype{signature, {}, {}});
+                for (auto &[mask, tables]: matchingTables) {
+                    if ((signature & mask) == mask) {
+                        tables.push_back(it->second);
+                    }
+                }
+            }
+            return it->second;
+        }
+
+        Record &AllocateRecord() {
+            size_t slot = records.size();
+            if (freeSlots.empty()) {
+                if (slot >= EntityID::MaxSlots) {
+                    throw std::length_error("Out of entity ids!");
+                }
+                records.push_back({.id = EntityID(slot)});
+            } else {
+                slot = freeSlots.back();
+                freeSlots.pop_back();
+            }
+            auto &record = records[slot];
+            record.active = true;
+            nrEntities++;
+            return record;
+        }
+
+        void Place(Record &record, size_t table) {
+            auto &archetype = archetypes[table];
+            record.archetype = table;
+            record.row = archetype.entities.size();
+            archetype.entities.push_back(record.id);
+        }
+
+        /**
+         * Moves the entity and the components it keeps over to the
+         * end of another table.
+         */
+        void Move(Record &record, size_t table) {
+            auto &source = archetypes[record.archetype];
+            auto &target = archetypes[table];
+            ([&] {
+                if (!IsTag<TComponents> && source.signature.test(Bit<TComponents>()) && target.signature.test(Bit<TComponents>())) {
+                    GetColumn<TComponents>(target).push_back(std::move(GetColumn<TComponents>(source)[record.row]));
+                }
+            }(), ...);
+            EraseRow(record.archetype, record.row);
+            Place(record, table);
+        }
+
+        /**
+         * Swaps the last row of the table into the given row and
+         * drops the last row.
+         */
+        void EraseRow(size_t table, size_t row) {
+            auto &archetype = archetypes[table];
+            auto last = archetype.entities.size() - 1;
+            ([&] {
+                if (!IsTag<TComponents> && archetype.signature.test(Bit<TComponents>())) {
+                    auto &column = GetColumn<TComponents>(archetype);
+                    if (row != last) {
+                        column[row] = std::move(column[last]);
+                    }
+                    column.pop_back();
+                }
+            }(), ...);
+            if (row != last) {
+                archetype.entities[row] = archetype.entities[last];
+                records[archetype.entities[row].GetId()].row = row;
+            }
+            archetype.entities.pop_back();
+        }
+
+        [[nodiscard]] bool IsAlive(const EntityID &id) const {
+            if (id.GetId() >= records.size()) {
+                return false;
+            }
+            const auto &record = records[id.GetId()];
+            return record.active && record.id == id;
+        }
+
+        inline void ValidateEntityID(EntityID id) const {
+            if (not id) {
+                throw std::logic_error("ID not initialized!");
+            }
+        }
+
+        Record &GetRecord(const EntityID &id) {
+            ValidateEntityID(id);
+            if (!IsAlive(id)) {
+                throw std::invalid_argument("Entity not alive, the id is stale or unknown.");
+            }
+            return records[id.GetId()];
+        }
+
+        size_t nrEntities = 0;
+        std::vector<Record> records;
+        std::vector<size_t> freeSlots;
+        std::vector<Archetype> archetypes;
+        std::unordered_map<Signature, size_t> archetypeIndex;
+        std::unordered_map<Signature, std::vector<size_t>> matchingTables;
+    };
+}
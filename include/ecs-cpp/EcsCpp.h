@@ -10,10 +10,42 @@
 #include <algorithm>
 #include <stdexcept>
 #include <optional>
+#include <queue>
+#include <deque>
+#include <atomic>
+#include <functional>
+#include <bit>
+#include <span>
 #include "EntityID.h"
 #include "EcsUtil.h"
+#include "ComponentStorage.h"
+#include "Signature.h"
+#include "OccupancyBitmap.h"
+#include "QueryTerms.h"
+#include "ThreadPool.h"
 
 namespace ecs {
+    /**
+     * Partition
+     * How GetSystemPart splits a system into parts.
+     * Slots: every part gets a equal share of the entity slots,
+     * free to compute but parts get uneven work when the matching
+     * entities are clustered.
+     * Balanced: every part gets a equal share of the matching
+     * entities, found by counting the matches when the part is
+     * created. Use GetSystemParts to count once for all parts.
+     * Aligned: like Slots but the part boundaries are rounded to
+     * blocks of 64 slots, so threads writing to neighbouring parts
+     * never share a cache line of a dense component array. Parts
+     * of a cached query or a sparse driven system are split as
+     * with Slots, as their order is not the slot order.
+     */
+    enum class Partition {
+        Slots,
+        Balanced,
+        Aligned,
+    };
+
     /**
     * ECSManager
     * A ECS container that keeps track of all components
@@ -41,20 +73,24 @@ namespace ecs {
         using TComponentPack = std::tuple<TComponents...>;
         using TECSManager = ECSManager<TComponents...>;
 
-        template<typename TComponent>
-        using ComponentArray = std::vector<TComponent>;
-        using ComponentMatrix = std::tuple<ComponentArray<TComponents>...>;
+        using ComponentStorages = std::tuple<StorageFor<TComponents>...>;
 
-        template<typename /*TComponent*/>
-        struct AvailableComponent {
-            bool active = false;
-        };
-        using AvailableComponents = std::tuple<AvailableComponent<TComponents>...>;
+        /**
+         * One bit per component, and a last bit that tells if the
+         * slot holds a active entity.
+         */
+        using ComponentSignature = Signature<sizeof...(TComponents) + 1>;
+        static constexpr size_t AliveBit = sizeof...(TComponents);
 
+        /**
+         * The number of entities that has the component, and the
+         * first and last slot holding it.
+         */
         template<typename TComponent>
         struct ComponentRange {
             using TComponentRange = TComponent;
             bool componentPresent = false;
+            size_t count = 0;
             size_t firstSlot = SIZE_MAX;
             size_t lastSlot = 0;
         };
@@ -66,53 +102,338 @@ namespace ecs {
         };
 
         /**
-         * Entity
-         * The entity in the ECS, tracks its own ID if it is
-         * active and if it has any components added to it.
+         * The entities in the ECS, one id per slot holding the
+         * current generation of the slot. If the entity is active
+         * and which components it has is kept in a signature per
+         * slot.
+         */
+        using EntitiesSlots = std::vector<EntityID>;
+        using SignatureSlots = std::vector<ComponentSignature>;
+        using ComponentOccupancy = std::array<OccupancyBitmap, sizeof...(TComponents)>;
+
+        template<typename TEntityComponent>
+        static constexpr size_t ComponentBit() {
+            return IndexInPack<TEntityComponent, TComponents...>();
+        }
+
+        template<typename... TEntityComponents>
+        static constexpr ComponentSignature MakeMask() {
+            ComponentSignature mask;
+            (mask.Set(ComponentBit<TEntityComponents>()), ...);
+            return mask;
+        }
+
+        /**
+         * Mask of the given components, computed at compile time.
+         */
+        template<typename... TEntityComponents>
+        static constexpr ComponentSignature ComponentMask = MakeMask<TEntityComponents...>();
+
+        template<typename... TSystemComponents>
+        using RequiredComponents = typename QueryTerms<TSystemComponents...>::Required;
+
+        template<typename... TSystemComponents>
+        using ExcludedComponents = typename QueryTerms<TSystemComponents...>::Excluded;
+
+        /**
+         * The bits of the signature a system looks at, and the value
+         * they need to have for a entity to match. Required
+         * components and the alive bit has to be set, excluded
+         * components has to be unset.
+         */
+        struct QueryMasks {
+            ComponentSignature mask;
+            ComponentSignature expected;
+        };
+
+        template<typename... TSystemComponents>
+        static constexpr QueryMasks SystemMask = [] {
+            QueryMasks masks;
+            TupleTypes<RequiredComponents<TSystemComponents...>>::Apply([&]<typename... TRequired>() {
+                (masks.expected.Set(ComponentBit<TRequired>()), ...);
+            });
+            masks.expected.Set(AliveBit);
+            masks.mask = masks.expected;
+            TupleTypes<ExcludedComponents<TSystemComponents...>>::Apply([&]<typename... TExcluded>() {
+                (masks.mask.Set(ComponentBit<TExcluded>()), ...);
+            });
+            return masks;
+        }();
+
+        /**
+         * QueryCache
+         * The packed list of slots matching a registered query, kept
+         * up to date as the signatures of the slots change. Removal
+         * swaps the last slot into the hole, so the list does not
+         * keep slot order.
+         */
+        struct QueryCache {
+            static constexpr size_t NotListed = SIZE_MAX;
+
+            explicit QueryCache(const QueryMasks &masks) : masks(masks) {}
+
+            QueryMasks masks;
+            std::vector<size_t> slots;
+            std::vector<size_t> positions;
+
+            void Update(size_t slot, const ComponentSignature &signature) {
+                if (slot >= positions.size()) {
+                    positions.resize(slot + 1, NotListed);
+                }
+                auto match = signature.Matches(masks.mask, masks.expected);
+                auto position = positions[slot];
+                if (match && position == NotListed) {
+                    positions[slot] = slots.size();
+                    slots.push_back(slot);
+                } else if (!match && position != NotListed) {
+                    slots[position] = slots.back();
+                    positions[slots[position]] = position;
+                    slots.pop_back();
+                    positions[slot] = NotListed;
+                }
+            }
+        };
+
+        template<typename... TSystemComponents>
+        bool HasGivenComponents(size_t slot) const {
+            constexpr auto &masks = SystemMask<TSystemComponents...>;
+            return signatures[slot].Matches(masks.mask, masks.expected);
+        }
+
+        /**
+         * Checks the Changed and Added filters of the query, the
+         * components has to be stamped after the since tick.
+         */
+        template<typename... TSystemComponents>
+        bool TicksMatch(size_t slot, Tick since) const {
+            using Terms = QueryTerms<TSystemComponents...>;
+            auto changed = TupleTypes<typename Terms::ChangedSince>::Apply([&]<typename... TChanged>() {
+                return ((GetStorage<TChanged>().GetChanged(slot) > since) && ...);
+            });
+            auto added = TupleTypes<typename Terms::AddedSince>::Apply([&]<typename... TAdded>() {
+                return ((GetStorage<TAdded>().GetAdded(slot) > since) && ...);
+            });
+            return changed && added;
+        }
+
+        template<typename... TSystemComponents>
+        bool MatchesSlot(size_t slot, Tick since) const {
+            if constexpr (QueryTerms<TSystemComponents...>::HasTickFilter) {
+                return HasGivenComponents<TSystemComponents...>(slot) && TicksMatch<TSystemComponents...>(slot, since);
+            } else {
+                return HasGivenComponents<TSystemComponents...>(slot);
+            }
+        }
+
+        /**
+         * If the query only hands out read only access, a system of
+         * it then only needs a const ECSManager.
+         */
+        template<typename... TSystemComponents>
+        static constexpr bool ReadOnlyQuery = QueryTerms<TSystemComponents...>::IsReadOnly;
+
+        /**
+         * The ECSManager a system works on, const for read only
+         * queries.
+         */
+        template<typename... TSystemComponents>
+        using QueryManager = std::conditional_t<ReadOnlyQuery<TSystemComponents...>, const TECSManager, TECSManager>;
+
+        /**
+         * Hands out what a fetched query term gives for a slot, a
+         * plain component is read from its storage. Mutable access
+         * stamps the component as changed at the current tick.
+         */
+        template<typename TTerm>
+        struct FetchAccessor {
+            template<typename TManager>
+            explicit FetchAccessor(TManager &ecs) : accessor(ecs.template GetStorage<std::remove_const_t<TTerm>>()), stamper(MakeStamper(ecs)) {}
+
+            [[nodiscard]] TTerm &Get(size_t slot) const {
+                if constexpr (!std::is_const_v<TTerm>) {
+                    stamper.Stamp(slot);
+                }
+                return accessor.Get(slot);
+            }
+
+        private:
+            struct NoStamper {
+            };
+            using TStamper = std::conditional_t<std::is_const_v<TTerm>, NoStamper, ChangedStamper<std::remove_const_t<TTerm>>>;
+
+            template<typename TManager>
+            static TStamper MakeStamper(TManager &ecs) {
+                if constexpr (std::is_const_v<TTerm>) {
+                    return {};
+                } else {
+                    return TStamper(ecs.template GetStorage<TTerm>(), ecs.currentTick);
+                }
+            }
+
+            StorageAccessor<TTerm> accessor;
+            [[no_unique_address]] TStamper stamper;
+        };
+
+        /**
+         * A optional component, a pointer into the storage if the
+         * signature of the slot has the component, else nullptr.
+         */
+        template<typename TComponent>
+        struct FetchAccessor<Maybe<TComponent>> {
+            template<typename TManager>
+            explicit FetchAccessor(TManager &ecs) : accessor(ecs), signatures(ecs.signatures.data()) {}
+
+            [[nodiscard]] TComponent *Get(size_t slot) const {
+                return signatures[slot].Test(ComponentBit<TComponent>()) ? &accessor.Get(slot) : nullptr;
+            }
+
+        private:
+            FetchAccessor<TComponent> accessor;
+            const ComponentSignature *signatures;
+        };
+
+        /**
+         * The id of the entity in the slot.
          */
-        struct Entity {
-            AvailableComponents activeComponents{};
-            bool active = false;
-            EntityID id = EntityID(0);
+        template<typename TTerm>
+        requires std::same_as<TTerm, Entity>
+        struct FetchAccessor<TTerm> {
+            template<typename TManager>
+            explicit FetchAccessor(TManager &ecs) : ids(ecs.entities.data()) {}
+
+            [[nodiscard]] EntityID Get(size_t slot) const {
+                return ids[slot];
+            }
+
+        private:
+            const EntityID *ids;
         };
-        using EntitiesSlots = std::vector<Entity>;
+
+        template<typename TFetched>
+        struct FetchAccessorsOf;
+
+        template<typename... TFetched>
+        struct FetchAccessorsOf<std::tuple<TFetched...>> {
+            using type = std::tuple<FetchAccessor<TFetched>...>;
+        };
+
+        template<typename... TSystemComponents>
+        using FetchAccessors = typename FetchAccessorsOf<typename QueryTerms<TSystemComponents...>::Fetched>::type;
+
+        template<typename... TSystemComponents>
+        static FetchAccessors<TSystemComponents...> MakeAccessors(QueryManager<TSystemComponents...> &ecs) {
+            return TupleTypes<typename QueryTerms<TSystemComponents...>::Fetched>::Apply([&]<typename... TFetched>() {
+                return FetchAccessors<TSystemComponents...>(FetchAccessor<TFetched>(ecs)...);
+            });
+        }
+
+        /**
+         * If all fetched terms are components in dense storage, so
+         * they can be handed out as spans.
+         */
+        template<typename... TSystemComponents>
+        static constexpr bool ChunkFetchable = TupleTypes<typename QueryTerms<TSystemComponents...>::Fetched>::Apply([]<typename... TFetched>() {
+            return ((QueryTerm<TFetched>::IsComponent && StoragePolicy<std::remove_const_t<TFetched>>::value == StorageType::Dense) && ...);
+        });
+
+        /**
+         * Intersection of the occupancy of the required components
+         * for the given word, or of their summaries. All bits set if
+         * the system has no required components.
+         */
+        template<typename... TSystemComponents>
+        uint64_t RequiredOccupancy(size_t word) const {
+            return TupleTypes<RequiredComponents<TSystemComponents...>>::Apply([&]<typename... TRequired>() {
+                return (occupancy[ComponentBit<TRequired>()].Word(word) & ... & ~uint64_t(0));
+            });
+        }
+
+        template<typename... TSystemComponents>
+        uint64_t RequiredSummary(size_t index) const {
+            return TupleTypes<RequiredComponents<TSystemComponents...>>::Apply([&]<typename... TRequired>() {
+                return (occupancy[ComponentBit<TRequired>()].SummaryWord(index) & ... & ~uint64_t(0));
+            });
+        }
 
         /**
          * SystemIterator
          * A iterator that loops over the matching components,
          * skipping the ones that does not have the correct
          * components active.
-         * @tparam TSystemComponents list of components that
-         * iterator tracks.
+         * Walks either the entity slots directly, or a packed list
+         * of slots when a sparse component drives the iteration.
+         * When walking the entity slots the signatures are matched
+         * a block of 64 at a time, the matches left in the current
+         * block are kept as a bitmask.
+         * Dereferencing reads straight from the component storages
+         * without the checks of Get, the slot is already known to
+         * hold a active entity with all the components.
+         * @tparam TSystemComponents list of components and query
+         * terms that iterator tracks.
          */
         template<typename... TSystemComponents>
         struct SystemIterator {
         private:
-            using TInternalIterator = typename TECSManager::EntitiesSlots::const_iterator;
+            using TManager = QueryManager<TSystemComponents...>;
         public:
-            [[maybe_unused]] SystemIterator(TECSManager &ecs, TInternalIterator begin, TInternalIterator end) : ecs(ecs), begin(begin), end(end) {}
+            [[maybe_unused]] SystemIterator(TManager &ecs, const size_t *slotList, size_t index, size_t end, Tick since = 0) : ecs(ecs), accessors(MakeAccessors<TSystemComponents...>(ecs)), slotList(slotList), index(index), end(end), since(since) {
+                Seek(index);
+            }
 
-            auto operator*() const { return ecs.template GetSeveral<TSystemComponents ...>(begin->id); }
+            auto operator*() const {
+                auto slot = Slot();
+                return std::apply([slot](const auto &...accessor) {
+                    return std::tuple<decltype(accessor.Get(slot))...>(accessor.Get(slot)...);
+                }, accessors);
+            }
 
             SystemIterator &operator++() {
-                begin++;
-                while (begin != end) {
-                    if (ecs.HasGivenComponents<TSystemComponents ...>(begin)) {
-                        break;
-                    }
-                    begin++;
+                if (slotList) {
+                    index = ecs.template FindMatch<TSystemComponents ...>(slotList, index + 1, end, since);
+                    return *this;
+                }
+                pending &= pending - 1;
+                if (pending) {
+                    index = blockBegin + std::countr_zero(pending);
+                } else {
+                    Seek(blockBegin + MatchBlockSize);
                 }
                 return *this;
             }
 
-            friend bool operator==(const SystemIterator &a, const SystemIterator &b) { return a.begin == b.begin; };
+            /**
+             * The id of the entity the iterator points at.
+             */
+            [[nodiscard]] EntityID GetEntityID() const {
+                return ecs.entities[Slot()];
+            }
+
+            friend bool operator==(const SystemIterator &a, const SystemIterator &b) { return a.index == b.index; };
 
-            friend bool operator!=(const SystemIterator &a, const SystemIterator &b) { return a.begin != b.begin; };
+            friend bool operator!=(const SystemIterator &a, const SystemIterator &b) { return a.index != b.index; };
 
         private:
-            TECSManager &ecs;
-            TInternalIterator begin;
-            const TInternalIterator end;
+            [[nodiscard]] size_t Slot() const {
+                return slotList ? slotList[index] : index;
+            }
+
+            void Seek(size_t from) {
+                if (slotList) {
+                    index = ecs.template FindMatch<TSystemComponents ...>(slotList, from, end, since);
+                    return;
+                }
+                blockBegin = ecs.template FindMatchBlock<TSystemComponents ...>(from, end, pending, since);
+                index = pending ? blockBegin + std::countr_zero(pending) : end;
+            }
+
+            TManager &ecs;
+            FetchAccessors<TSystemComponents...> accessors;
+            const size_t *slotList = nullptr;
+            size_t index = 0;
+            size_t end = 0;
+            size_t blockBegin = 0;
+            uint64_t pending = 0;
+            Tick since = 0;
         };
 
         /**
@@ -122,15 +443,34 @@ namespace ecs {
          * components.
          * The lifetime of a System needs to be shorter then
          * its underlying ecs as it stores a reference to it.
-         * @tparam TSystemComponents components to filter on.
+         * Besides components the system can be given query terms,
+         * With<...> requires components without fetching them,
+         * Without<...> skips entities that has the components and
+         * Maybe<T> fetches a optional component as a pointer and
+         * Entity fetches the EntityID of the entity.
+         * Const components are fetched as const references, a system
+         * that only fetches const components holds a const reference
+         * to the ECSManager.
+         * @tparam TSystemComponents components and query terms to
+         * filter on.
          */
         template<typename... TSystemComponents>
         struct System {
         private:
             using TSystemIterator = SystemIterator<TSystemComponents...>;
+            using TManager = QueryManager<TSystemComponents...>;
         public:
-            constexpr System(TECSManager &ecs, size_t part, size_t totalParts) : ecs(ecs), part(part), totalParts(totalParts), componentRangesMatch(ecs.GetSystemFilterMatch<TSystemComponents...>()) {
+            constexpr System(TManager &ecs, size_t part, size_t totalParts, Partition partition = Partition::Slots) : ecs(ecs), part(part), totalParts(totalParts), partition(partition), componentRangesMatch(ecs.template GetSystemFilterMatch<TSystemComponents...>()), slotList(ecs.template GetDrivingSlots<TSystemComponents...>()) {
                 ValidateInvariant();
+                Balance();
+            }
+
+            /**
+             * A system that walks the given list of matching slots,
+             * used by cached queries.
+             */
+            constexpr System(TManager &ecs, const std::vector<size_t> &slots, size_t part, size_t totalParts, Partition partition = Partition::Slots) : ecs(ecs), part(part), totalParts(totalParts), partition(partition), componentRangesMatch(ComponentRangesMatch{0, 0}), slotList(&slots) {
+                Balance();
             }
 
             /**
@@ -143,52 +483,300 @@ namespace ecs {
                 if (!componentRangesMatch) {
                     return end();
                 }
-                auto end = ecsEnd();
-                auto begin = ecsBegin();
-                while (begin != end) {
-                    if (ecs.HasGivenComponents<TSystemComponents ...>(begin)) {
-                        break;
+                return TSystemIterator(ecs, slotData(), beginIndex(), endIndex(), since);
+            }
+
+            /**
+             * Returns a iterator to end value in the system.
+             * @return TSystemIterator to end iterator.
+             */
+            [[nodiscard]] TSystemIterator end() const { return TSystemIterator(ecs, slotData(), endIndex(), endIndex(), since); }
+
+            /**
+             * Returns a copy of the system where the Changed and
+             * Added filters only match components stamped after the
+             * given tick. Without it they match everything.
+             * A run stamps what it fetches mutably with the current
+             * tick, so keep GetTick() from before the run, call
+             * AdvanceTick after it and pass the kept tick to the next
+             * run. The run then does not see its own writes again,
+             * while every write made after it carries a later tick
+             * and is seen once:
+             * auto thisRun = ecs.GetTick();
+             * for (auto [pos]: ecs.GetSystem<Position, Changed<Position>>().Since(lastRun)) {...}
+             * ecs.AdvanceTick();
+             * lastRun = thisRun;
+             * @param tick the tick of the previous run.
+             * @return System the filtered system.
+             */
+            [[nodiscard]] System Since(Tick tick) const {
+                auto system = *this;
+                system.since = tick;
+                system.Balance();
+                return system;
+            }
+
+            /**
+             * Splits the whole system into parts, the same parts as
+             * GetSystemPart gives for each part. With
+             * Partition::Balanced the matches are only counted once
+             * for all parts, instead of once per part.
+             * @param totalParts the total number of parts.
+             * @param partition how the system is split into parts.
+             * @return std::vector<System> the parts, in order.
+             */
+            [[nodiscard]] std::vector<System> Split(size_t totalParts, Partition partition = Partition::Slots) const {
+                std::vector<size_t> boundaries;
+                if (partition == Partition::Balanced && componentRangesMatch) {
+                    boundaries = BalancedBoundaries(totalParts);
+                }
+                std::vector<System> parts;
+                parts.reserve(totalParts);
+                for (size_t index = 0; index < totalParts; index++) {
+                    auto &system = parts.emplace_back(*this);
+                    system.part = index;
+                    system.totalParts = totalParts;
+                    system.partition = partition;
+                    system.balancedRange.reset();
+                    if (!boundaries.empty()) {
+                        system.balancedRange = std::make_pair(boundaries[index], boundaries[index + 1]);
                     }
-                    begin++;
                 }
-                return TSystemIterator(ecs, begin, end);
+                return parts;
+            }
+
+            /**
+             * Calls the function with the components of every
+             * matching entity, driving the loop internally.
+             * Consecutive matching slots are visited in a plain loop
+             * over the component arrays, which lets the compiler
+             * vectorize it for trivial components.
+             * Entities can not be added or removed from within the
+             * function.
+             * @param function called as function(TSystemComponents&...),
+             * or function(EntityID, TSystemComponents&...), with only
+             * the fetched components.
+             */
+            template<typename TFunction>
+            void ForEach(TFunction &&function) const {
+                if (!componentRangesMatch) {
+                    return;
+                }
+                ForEachIn(beginIndex(), endIndex(), function);
             }
 
+            /**
+             * Same as ForEach but spreads the matching entities over
+             * the threads of the pool. The work is split in chunks of
+             * 64 slots, or 64 entries of the slot list of a query,
+             * which can hold fewer matches, and idle threads steal
+             * chunks from the busy ones. The function is called
+             * concurrently for different entities.
+             * @param function called as in ForEach.
+             * @param pool the pool to run on.
+             */
+            template<typename TFunction>
+            void ParallelForEach(TFunction &&function, ThreadPool &pool = ThreadPool::Global()) const {
+                if (!componentRangesMatch) {
+                    return;
+                }
+                pool.ParallelFor(beginIndex(), endIndex(), MatchBlockSize, [&](size_t first, size_t last) {
+                    ForEachIn(first, last, function);
+                });
+            }
 
             /**
-             * Returns a iterator to end value in the system.
-             * @return TSystemIterator to end iterator.
+             * Calls the function once for every run of consecutive
+             * matching entities, with spans over the components and
+             * ids of the run. Only for components in dense storage,
+             * as those are laid out by slot. When a sparse With
+             * component drives the iteration every match is its own
+             * run, as the sparse slots are not kept in order.
+             * Entities can not be added or removed from within the
+             * function.
+             * @param function called as function(std::span<TSystemComponents>...,
+             * std::span<const EntityID>).
              */
-            [[nodiscard]] TSystemIterator end() const { return TSystemIterator(ecs, ecsEnd(), ecsEnd()); }
+            template<typename TFunction>
+            requires ChunkFetchable<TSystemComponents...>
+            void ForEachChunk(TFunction &&function) const {
+                if (!componentRangesMatch) {
+                    return;
+                }
+                const auto *ids = ecs.entities.data();
+                TupleTypes<typename QueryTerms<TSystemComponents...>::Fetched>::Apply([&]<typename... TFetched>() {
+                    auto data = std::make_tuple(ecs.template GetStorage<std::remove_const_t<TFetched>>().Data()...);
+                    auto run = [&](size_t first, size_t last) {
+                        auto count = last - first;
+                        ([&] {
+                            if constexpr (!std::is_const_v<TFetched>) {
+                                auto *changed = ecs.template GetStorage<TFetched>().ChangedData();
+                                std::fill(changed + first, changed + last, ecs.currentTick);
+                            }
+                        }(), ...);
+                        std::apply([&](auto *...components) {
+                            function(std::span<TFetched>(components + first, count)..., std::span<const EntityID>(ids + first, count));
+                        }, data);
+                    };
+                    ForEachSlotRun(beginIndex(), endIndex(), run);
+                });
+            }
 
         private:
-            auto ecsEnd() const {
-                return ecs.end() - endIteratorOffset() - (componentRangesMatch ? ecs.ContainerSize() - 1 - componentRangesMatch->lastSlot : 0);
+            /**
+             * Calls the function for the matching entities in
+             * [first, last) of the domain of the system.
+             */
+            template<typename TFunction>
+            void ForEachIn(size_t first, size_t last, TFunction &function) const {
+                std::apply([&](const auto... accessor) {
+                    auto call = [&](size_t slot) {
+                        if constexpr (std::is_invocable_v<TFunction &, EntityID, decltype(accessor.Get(slot))...>) {
+                            function(ecs.entities[slot], accessor.Get(slot)...);
+                        } else {
+                            function(accessor.Get(slot)...);
+                        }
+                    };
+                    ForEachSlotRun(first, last, [&](size_t runBegin, size_t runEnd) {
+                        for (auto slot = runBegin; slot < runEnd; slot++) {
+                            call(slot);
+                        }
+                    });
+                }, MakeAccessors<TSystemComponents...>(ecs));
             }
 
-            auto ecsBegin() const {
-                return ecs.begin() + beginIteratorOffset() + (componentRangesMatch ? componentRangesMatch->firstSlot : 0);
+            const size_t *slotData() const {
+                return slotList ? slotList->data() : nullptr;
             }
 
-            constexpr size_t partSize() const {
-                return ecs.ContainerSize() / totalParts;
+            size_t domainSize() const {
+                return slotList ? slotList->size() : ecs.ContainerSize();
+            }
+
+            size_t domainBegin() const {
+                return !slotList && componentRangesMatch ? componentRangesMatch->firstSlot : 0;
+            }
+
+            size_t domainEnd() const {
+                auto index = domainSize();
+                if (!slotList && componentRangesMatch) {
+                    index = std::min(index, componentRangesMatch->lastSlot + 1);
+                }
+                return std::max(domainBegin(), index);
+            }
+
+            /**
+             * Calls run(first, last) for every run of consecutive
+             * matching indices in [index, end).
+             */
+            template<typename TRunFunction>
+            void ForEachMatchRun(size_t index, size_t end, TRunFunction &&run) const {
+                if (slotList) {
+                    for (; index < end; index++) {
+                        if (ecs.template MatchesSlot<TSystemComponents...>((*slotList)[index], since)) {
+                            run(index, index + 1);
+                        }
+                    }
+                    return;
+                }
+                ecs.template ForEachRun<TSystemComponents...>(index, end, since, run);
+            }
+
+            /**
+             * Calls run(first, last) for every run of consecutive
+             * matching slots at the indices [index, end), see
+             * ForEachMatchRun. The slots of a slot list are not in
+             * order, so each of them is a run of its own.
+             */
+            template<typename TRunFunction>
+            void ForEachSlotRun(size_t index, size_t end, TRunFunction &&run) const {
+                ForEachMatchRun(index, end, [&](size_t first, size_t last) {
+                    if (!slotList) {
+                        run(first, last);
+                        return;
+                    }
+                    for (auto position = first; position < last; position++) {
+                        auto slot = (*slotList)[position];
+                        run(slot, slot + 1);
+                    }
+                });
             }
 
-            constexpr bool hasRemainder() const {
-                return ecs.ContainerSize() % totalParts != 0;
+            /**
+             * For Partition::Balanced, places the part boundaries so
+             * that every part gets a equal share of the matches.
+             */
+            void Balance() {
+                balancedRange.reset();
+                if (partition != Partition::Balanced || !componentRangesMatch) {
+                    return;
+                }
+                auto boundaries = BalancedBoundaries(totalParts);
+                balancedRange = std::make_pair(boundaries[part], boundaries[part + 1]);
             }
 
-            size_t endIteratorOffset() const {
-                if (hasRemainder()) {
-                    if (part == totalParts - 1) {
-                        return 0;
+            /**
+             * The index where each of nrParts parts with a equal
+             * share of the matches starts, followed by the end. The
+             * matches are counted in one pass and every boundary is
+             * located in a second.
+             */
+            std::vector<size_t> BalancedBoundaries(size_t nrParts) const {
+                size_t total = 0;
+                ForEachMatchRun(domainBegin(), domainEnd(), [&](size_t first, size_t last) {
+                    total += last - first;
+                });
+                std::vector<size_t> boundaries(nrParts + 1, domainEnd());
+                size_t boundary = 0;
+                size_t seen = 0;
+                ForEachMatchRun(domainBegin(), domainEnd(), [&](size_t first, size_t last) {
+                    auto length = last - first;
+                    for (; boundary < nrParts && total * boundary / nrParts < seen + length; boundary++) {
+                        boundaries[boundary] = first + (total * boundary / nrParts - seen);
                     }
+                    seen += length;
+                });
+                return boundaries;
+            }
+
+            size_t beginIndex() const {
+                if (balancedRange) {
+                    return balancedRange->first;
+                }
+                auto index = partBoundary(part);
+                if (!slotList && componentRangesMatch) {
+                    index = std::max(index, componentRangesMatch->firstSlot);
                 }
-                return ecs.ContainerSize() - (part + 1) * partSize();
+                return index;
             }
 
-            size_t beginIteratorOffset() const {
-                return part * partSize();
+            size_t endIndex() const {
+                if (balancedRange) {
+                    return balancedRange->second;
+                }
+                auto index = partBoundary(part + 1);
+                if (!slotList && componentRangesMatch) {
+                    index = std::min(index, componentRangesMatch->lastSlot + 1);
+                }
+                return std::max(beginIndex(), index);
+            }
+
+            constexpr size_t partSize() const {
+                return domainSize() / totalParts;
+            }
+
+            /**
+             * The index where the given part starts.
+             */
+            size_t partBoundary(size_t index) const {
+                if (index == totalParts) {
+                    return domainSize();
+                }
+                if (partition == Partition::Aligned && !slotList) {
+                    auto blocks = (domainSize() + MatchBlockSize - 1) / MatchBlockSize;
+                    return std::min(domainSize(), blocks * index / totalParts * MatchBlockSize);
+                }
+                return index * partSize();
             }
 
             void ValidateInvariant() const {
@@ -197,10 +785,89 @@ namespace ecs {
                 }
             }
 
-            TECSManager &ecs;
+            TManager &ecs;
             size_t part = 0;
             size_t totalParts = 1;
+            Partition partition = Partition::Slots;
             std::optional<ComponentRangesMatch> componentRangesMatch{};
+            const std::vector<size_t> *slotList = nullptr;
+            Tick since = 0;
+            std::optional<std::pair<size_t, size_t>> balancedRange{};
+        };
+
+        /**
+         * Query
+         * A persistent query registered with the ECSManager, that
+         * keeps a packed list of the matching slots. The list is
+         * updated as components and entities are added and removed,
+         * so iterating the query only touches the matches. The order
+         * of the matches is not the slot order.
+         * A query stays valid for as long as the ECSManager it was
+         * created from.
+         * @tparam TSystemComponents components and query terms to
+         * filter on.
+         */
+        template<typename... TSystemComponents>
+        class Query {
+        private:
+            using TSystem = System<TSystemComponents...>;
+            using TManager = QueryManager<TSystemComponents...>;
+        public:
+            Query(TManager &ecs, const QueryCache &cache) : ecs(ecs), cache(&cache) {}
+
+            /**
+             * Returns a system over the current matches.
+             */
+            [[nodiscard]] TSystem GetSystem() const {
+                return GetSystemPart(0, 1);
+            }
+
+            /**
+             * Returns a part of the system over the current matches.
+             * @param part the part of the system to return. 0 indexed.
+             * @param totalParts the total number of parts.
+             * @param partition how the matches are split into parts.
+             */
+            [[nodiscard]] TSystem GetSystemPart(size_t part, size_t totalParts, Partition partition = Partition::Slots) const {
+                return TSystem(ecs, cache->slots, part, totalParts, partition);
+            }
+
+            /**
+             * Returns every part of the system over the current
+             * matches, see System::Split.
+             */
+            [[nodiscard]] std::vector<TSystem> GetSystemParts(size_t totalParts, Partition partition = Partition::Slots) const {
+                return GetSystem().Split(totalParts, partition);
+            }
+
+            [[nodiscard]] auto begin() const {
+                return GetSystem().begin();
+            }
+
+            [[nodiscard]] auto end() const {
+                return GetSystem().end();
+            }
+
+            template<typename TFunction>
+            void ForEach(TFunction &&function) const {
+                GetSystem().ForEach(std::forward<TFunction>(function));
+            }
+
+            template<typename TFunction>
+            void ParallelForEach(TFunction &&function, ThreadPool &pool = ThreadPool::Global()) const {
+                GetSystem().ParallelForEach(std::forward<TFunction>(function), pool);
+            }
+
+            /**
+             * Number of entities matching the query.
+             */
+            [[nodiscard]] size_t Size() const {
+                return cache->slots.size();
+            }
+
+        private:
+            TManager &ecs;
+            const QueryCache *cache;
         };
 
     public:
@@ -221,7 +888,7 @@ namespace ecs {
         requires NonVoidArgs<TEntityComponents...>
         constexpr inline EntityID BuildEntity(TEntityComponents&&... args) {
             auto id = AddEntity();
-            (Add<TEntityComponents>(id, std::forward<TEntityComponents>(args)), ...);
+            (Add<std::remove_cvref_t<TEntityComponents>>(id, std::forward<TEntityComponents>(args)), ...);
             return id;
         }
 
@@ -233,7 +900,7 @@ namespace ecs {
          */
         template<typename TComponent>
         requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
-        constexpr void Add(const EntityID &entityId, const TComponent &component);
+        constexpr void Add(const EntityID &entityId, TComponent component);
 
         /**
          * Remove a entity from the ECS.
@@ -292,6 +959,56 @@ namespace ecs {
         requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
         [[nodiscard]] constexpr TComponent &Get(const EntityID &entityId);
 
+        /**
+         * Returns a const reference to the requested component data.
+         * @tparam TComponent the type of the component
+         * @param entityId reference to the entity.
+         * @return const TComponent& reference to the component.
+         */
+        template<typename TComponent>
+        requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
+        [[nodiscard]] constexpr const TComponent &Get(const EntityID &entityId) const;
+
+        /**
+         * Returns a reference to the single instance of a component
+         * with the Singleton storage policy.
+         * @tparam TComponent the type of the component
+         * @return TComponent& reference to the component.
+         */
+        template<typename TComponent>
+        requires TypeIn<TComponent, TComponents...> && (StoragePolicy<TComponent>::value == StorageType::Singleton)
+        [[nodiscard]] TComponent &GetSingleton() {
+            auto &storage = GetStorage<TComponent>();
+            if (storage.Slots().empty()) {
+                throw std::invalid_argument("Bad access, no entity has the singleton component.");
+            }
+            auto slot = storage.Slots().front();
+            storage.SetChanged(slot, currentTick);
+            return storage.Get(slot);
+        }
+
+        /**
+         * The current tick, components are stamped with it when they
+         * are added and when they are mutably accessed. The clock
+         * starts at 1, so System::Since(0) matches everything.
+         * @return Tick the current tick.
+         */
+        [[nodiscard]] Tick GetTick() const {
+            return currentTick;
+        }
+
+        /**
+         * Moves the world clock forward. Components stamped from
+         * here on carry the new tick. Call it after every run of a
+         * system that filters on Changed or Added, so the writes of
+         * the run are older than anything written after it, see
+         * System::Since.
+         * @return Tick the new current tick.
+         */
+        Tick AdvanceTick() {
+            return ++currentTick;
+        }
+
         /**
          * A getter to fetch multiple components at once.
          *
@@ -306,26 +1023,177 @@ namespace ecs {
             return std::forward_as_tuple(Get<TComponentsRequested>(entityId)...);
         }
 
+        template<typename... TComponentsRequested>
+        requires NonVoidArgs<TComponentsRequested...> && (TypeIn<TComponentsRequested, TComponents...> && ...)
+        [[nodiscard]] auto GetSeveral(const EntityID &entityId) const {
+            return std::forward_as_tuple(Get<TComponentsRequested>(entityId)...);
+        }
+
         /**
          * Returns a system which is a list of a set of components.
-         * @tparam TSystemComponents the list of components in the system.
+         * GetSystem<Position, Velocity, Without<Frozen>>() loops over
+         * all entities with Position and Velocity but not Frozen.
+         * @tparam TSystemComponents the list of components and query
+         * terms in the system.
          * @return System<TSystemComponents...> the system of components.
          */
         template<typename ... TSystemComponents>
-        requires NonVoidArgs<TSystemComponents...> && (TypeIn<TSystemComponents, TComponents...> && ...)
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
         [[nodiscard]] constexpr System<TSystemComponents...> GetSystem();
 
+        /**
+         * Returns a read only system from a const ECSManager, all
+         * fetched components has to be const.
+         * GetSystem<const Position, const Velocity>()
+         * @tparam TSystemComponents the list of components and query
+         * terms in the system.
+         * @return System<TSystemComponents...> the system of components.
+         */
+        template<typename ... TSystemComponents>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ReadOnlyQuery<TSystemComponents...>
+        [[nodiscard]] constexpr System<TSystemComponents...> GetSystem() const {
+            return GetSystemPart<TSystemComponents...>(0, 1);
+        }
+
         /**
          * Returns a part of the system which is a list of a set of components,
          * to be used for splitting the container up for multi threading purposes.
          * @tparam TSystemComponents the list of components in the system.
          * @param part the part of the system to return. 0 indexed, so 0 is the first part.
          * @param totalParts the total number of parts the container is split up into.
+         * @param partition Partition::Slots splits the entity slots evenly,
+         * Partition::Balanced splits the matching entities evenly.
          * @return System<TSystemComponents...> the system of components.
          */
         template<typename ... TSystemComponents>
-        requires NonVoidArgs<TSystemComponents...> && (TypeIn<TSystemComponents, TComponents...> && ...)
-        [[nodiscard]] constexpr System<TSystemComponents...> GetSystemPart(size_t part, size_t totalParts);
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+        [[nodiscard]] constexpr System<TSystemComponents...> GetSystemPart(size_t part, size_t totalParts, Partition partition = Partition::Slots);
+
+        /**
+         * Returns a part of a read only system from a const
+         * ECSManager, all fetched components has to be const.
+         */
+        template<typename ... TSystemComponents>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ReadOnlyQuery<TSystemComponents...>
+        [[nodiscard]] constexpr System<TSystemComponents...> GetSystemPart(size_t part, size_t totalParts, Partition partition = Partition::Slots) const {
+            return System<TSystemComponents...>(*this, part, totalParts, partition);
+        }
+
+        /**
+         * Returns every part of the system, the same parts as calling
+         * GetSystemPart for each part. With Partition::Balanced the
+         * matching entities are counted once for all parts, so
+         * prefer it over GetSystemPart when creating all of them.
+         * @tparam TSystemComponents the list of components in the system.
+         * @param totalParts the total number of parts the container is split up into.
+         * @param partition how the system is split into parts.
+         * @return std::vector<System<TSystemComponents...>> the parts, in order.
+         */
+        template<typename ... TSystemComponents>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+        [[nodiscard]] std::vector<System<TSystemComponents...>> GetSystemParts(size_t totalParts, Partition partition = Partition::Slots) {
+            return GetSystem<TSystemComponents...>().Split(totalParts, partition);
+        }
+
+        /**
+         * Returns every part of a read only system from a const
+         * ECSManager, all fetched components has to be const.
+         */
+        template<typename ... TSystemComponents>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ReadOnlyQuery<TSystemComponents...>
+        [[nodiscard]] std::vector<System<TSystemComponents...>> GetSystemParts(size_t totalParts, Partition partition = Partition::Slots) const {
+            return GetSystem<TSystemComponents...>().Split(totalParts, partition);
+        }
+
+        /**
+         * Returns a persistent query for the given components and
+         * query terms. The first call for a set of terms registers
+         * it with the ECSManager, which from then on keeps its list
+         * of matches up to date. Later calls with the same terms
+         * share that list.
+         * auto query = ecs.GetQuery<Position, Velocity>();
+         * for (auto [pos, vel]: query) {...}
+         * @tparam TSystemComponents the list of components and query
+         * terms in the query.
+         * @return Query<TSystemComponents...> the query.
+         */
+        template<typename... TSystemComponents>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+        [[nodiscard]] Query<TSystemComponents...> GetQuery() {
+            return Query<TSystemComponents...>(*this, RegisterQuery(SystemMask<TSystemComponents...>));
+        }
+
+        /**
+         * Calls the function with the components of every entity
+         * that has all the given components. Same as
+         * GetSystem<TSystemComponents...>().ForEach(function).
+         * ecs.ForEach<A, B>([](A &a, B &b) {...});
+         * ecs.ForEach<A, B>([](EntityID id, A &a, B &b) {...});
+         * @tparam TSystemComponents the components to loop over.
+         * @param function called for every matching entity.
+         */
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+        void ForEach(TFunction &&function);
+
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ReadOnlyQuery<TSystemComponents...>
+        void ForEach(TFunction &&function) const {
+            GetSystem<TSystemComponents...>().ForEach(std::forward<TFunction>(function));
+        }
+
+        /**
+         * Calls the function with the components of every entity
+         * that has all the given components, spread over the threads
+         * of the pool. Same as
+         * GetSystem<TSystemComponents...>().ParallelForEach(function, pool).
+         * The function is called concurrently for different entities,
+         * and entities can not be added or removed from within it.
+         * ecs.ParallelForEach<A, const B>([](A &a, const B &b) {...});
+         * @tparam TSystemComponents the components to loop over.
+         * @param function called for every matching entity.
+         * @param pool the pool to run on, a shared pool by default.
+         */
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+        void ParallelForEach(TFunction &&function, ThreadPool &pool = ThreadPool::Global()) {
+            GetSystem<TSystemComponents...>().ParallelForEach(std::forward<TFunction>(function), pool);
+        }
+
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ReadOnlyQuery<TSystemComponents...>
+        void ParallelForEach(TFunction &&function, ThreadPool &pool = ThreadPool::Global()) const {
+            GetSystem<TSystemComponents...>().ParallelForEach(std::forward<TFunction>(function), pool);
+        }
+
+        /**
+         * Calls the function once for every run of consecutive
+         * entities that has all the given components, with the
+         * components of the run as spans. Same as
+         * GetSystem<TSystemComponents...>().ForEachChunk(function).
+         * ecs.ForEachChunk<A, B>([](std::span<A> a, std::span<B> b, std::span<const EntityID> ids) {...});
+         * @tparam TSystemComponents the components to loop over, has
+         * to be in dense storage.
+         * @param function called for every run of matching entities.
+         */
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ChunkFetchable<TSystemComponents...>
+        void ForEachChunk(TFunction &&function) {
+            GetSystem<TSystemComponents...>().ForEachChunk(std::forward<TFunction>(function));
+        }
+
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...) &&
+                 ChunkFetchable<TSystemComponents...> && ReadOnlyQuery<TSystemComponents...>
+        void ForEachChunk(TFunction &&function) const {
+            GetSystem<TSystemComponents...>().ForEachChunk(std::forward<TFunction>(function));
+        }
 
         /**
          * Returns number of entities in ECS
@@ -333,8 +1201,95 @@ namespace ecs {
          */
         [[nodiscard]] constexpr size_t Size() const;
 
+        /**
+         * Reserves memory for the given number of entity slots, so
+         * adding entities up to it does not reallocate the entity
+         * and dense component arrays.
+         * @param nrSlots the number of slots to reserve memory for.
+         */
+        void Reserve(size_t nrSlots) {
+            entities.reserve(nrSlots);
+            signatures.reserve(nrSlots);
+            std::apply([&](auto &...storages) {
+                ([&] {
+                    if constexpr (requires { storages.Reserve(nrSlots); }) {
+                        storages.Reserve(nrSlots);
+                    }
+                }(), ...);
+            }, componentStorages);
+        }
+
+        /**
+         * Reserves the id of a new entity. Safe to call from several
+         * threads at once, and while systems are iterated, as it
+         * only moves atomic counters. Slots freed before the last
+         * commit are reused first, then new slots are taken. The
+         * entity is created at the next CommitReserved, until then
+         * it can only be used to record commands in a CommandBuffer.
+         * Not safe to call at the same time as AddEntity, Add,
+         * Remove or RemoveEntity.
+         * @return EntityID the id the entity will get.
+         */
+        [[nodiscard]] EntityID ReserveEntity() {
+            EntityID id;
+            ReserveSlots(1, [&](const EntityID &reserved) { id = reserved; });
+            return id;
+        }
+
+        /**
+         * Reserves the ids of count new entities in one atomic
+         * step, see ReserveEntity.
+         * @param count the number of entities.
+         * @return std::vector<EntityID> the ids the entities will get.
+         */
+        [[nodiscard]] std::vector<EntityID> ReserveEntities(size_t count) {
+            if (count > EntityID::MaxSlots - reservedEnd.value.load() + recycledEnd.value.load()) {
+                throw std::length_error("Out of entity ids!");
+            }
+            std::vector<EntityID> ids;
+            ids.reserve(count);
+            ReserveSlots(count, [&](const EntityID &reserved) { ids.push_back(reserved); });
+            return ids;
+        }
+
+        /**
+         * Creates every entity reserved since the last commit,
+         * growing the storage once for all of them. The slots freed
+         * since then are handed to the next reservations.
+         * Called by AddEntity and CommandBuffer::Apply, not thread
+         * safe.
+         */
+        void CommitReserved() {
+            auto recycledBegin = recycledEnd.value.load();
+            auto end = reservedEnd.value.load();
+            auto first = entities.size();
+            if (recycledBegin == recycledSlots.size() && end == first) {
+                return;
+            }
+            GrowSlots(end);
+            for (auto index = recycledBegin; index < recycledSlots.size(); index++) {
+                CreateReserved(recycledSlots[index]);
+            }
+            for (auto slot = first; slot < end; slot++) {
+                CreateReserved(slot);
+            }
+            nrEntities += recycledSlots.size() - recycledBegin + end - first;
+            recycledSlots.resize(recycledBegin);
+
+            std::vector<size_t> freed;
+            freed.reserve(freeSlots.size());
+            while (!freeSlots.empty()) {
+                freed.push_back(freeSlots.top());
+                freeSlots.pop();
+            }
+            recycledSlots.insert(recycledSlots.end(), freed.rbegin(), freed.rend());
+            recycledEnd.value = recycledSlots.size();
+        }
+
         /**
          * Begin iterator, first element in entities list.
+         * Yields the id of every slot, inactive slots has a
+         * stale id that HasEntity returns false for.
          * @return iterator to begin
          */
         [[nodiscard]] typename EntitiesSlots::const_iterator begin() const;
@@ -347,75 +1302,271 @@ namespace ecs {
 
     private:
         size_t ContainerSize() const {
-            return entities.size();
+            return endSlot;
         }
 
+        /**
+         * Finds the first index in [index, end) that matches the
+         * components, returns end if there is none.
+         * @param slotList packed slots to walk, or nullptr to walk
+         * the entity slots directly.
+         */
         template<typename... TSystemComponents>
-        bool HasGivenComponents(const auto& it) const {
-            return it->active && Has<TSystemComponents ...>(it->id);
+        size_t FindMatch(const size_t *slotList, size_t index, size_t end, Tick since) const {
+            while (index < end && !MatchesSlot<TSystemComponents ...>(slotList ? slotList[index] : index, since)) {
+                index++;
+            }
+            return index;
+        }
+
+        /**
+         * Number of entity slots matched in one go when walking the
+         * signatures, one word of the occupancy bitmaps.
+         */
+        static constexpr size_t MatchBlockSize = OccupancyBitmap::BitsPerWord;
+
+        /**
+         * Finds the first 64 aligned block of slots with at least
+         * one match in [index, end).
+         * The occupancy bitmaps of the required components are
+         * intersected to skip empty regions, first 4096 slots at a time using the
+         * summary level and then 64 slots at a time. The signatures
+         * of a block that is left are matched with MatchSignatures.
+         * @param matches set to the matches of the block, bit i is
+         * the slot at the returned index + i. 0 if there is none.
+         * @return size_t first slot of the block, end if there is none.
+         */
+        template<typename... TSystemComponents>
+        size_t FindMatchBlock(size_t index, size_t end, uint64_t &matches, Tick since) const {
+            constexpr size_t SlotsPerSummaryWord = OccupancyBitmap::SlotsPerSummaryWord;
+            while (index < end) {
+                auto word = index / MatchBlockSize;
+                auto summaryIndex = word / MatchBlockSize;
+                auto summaryBits = RequiredSummary<TSystemComponents...>(summaryIndex);
+                summaryBits &= ~uint64_t(0) << (word % MatchBlockSize);
+                if (!summaryBits) {
+                    index = (summaryIndex + 1) * SlotsPerSummaryWord;
+                    continue;
+                }
+                word = summaryIndex * MatchBlockSize + std::countr_zero(summaryBits);
+                auto blockBegin = word * MatchBlockSize;
+                index = std::max(index, blockBegin);
+                if (index >= end) {
+                    break;
+                }
+                auto count = std::min(MatchBlockSize, end - blockBegin);
+                if (RequiredOccupancy<TSystemComponents...>(word)) {
+                    constexpr auto &masks = SystemMask<TSystemComponents...>;
+                    matches = MatchSignatures(signatures.data() + blockBegin, count, masks.mask, masks.expected);
+                    matches &= ~uint64_t(0) << (index - blockBegin);
+                    if constexpr (QueryTerms<TSystemComponents...>::HasTickFilter) {
+                        for (auto bits = matches; bits; bits &= bits - 1) {
+                            auto bit = std::countr_zero(bits);
+                            if (!TicksMatch<TSystemComponents...>(blockBegin + bit, since)) {
+                                matches &= ~(uint64_t(1) << bit);
+                            }
+                        }
+                    }
+                    if (matches) {
+                        return blockBegin;
+                    }
+                }
+                index = blockBegin + MatchBlockSize;
+            }
+            matches = 0;
+            return end;
+        }
+
+        /**
+         * Calls run(first, last) for every run of consecutive
+         * matching slots in [index, end). Runs that continue over the
+         * edge of a block are merged into one.
+         */
+        template<typename... TSystemComponents, typename TRunFunction>
+        void ForEachRun(size_t index, size_t end, Tick since, TRunFunction &&run) const {
+            size_t runBegin = 0;
+            size_t runEnd = 0;
+            uint64_t matches = 0;
+            while (index < end) {
+                auto blockBegin = FindMatchBlock<TSystemComponents...>(index, end, matches, since);
+                while (matches) {
+                    auto first = static_cast<size_t>(std::countr_zero(matches));
+                    auto length = static_cast<size_t>(std::countr_one(matches >> first));
+                    if (blockBegin + first != runEnd) {
+                        if (runBegin != runEnd) {
+                            run(runBegin, runEnd);
+                        }
+                        runBegin = blockBegin + first;
+                    }
+                    runEnd = blockBegin + first + length;
+                    if (first + length == MatchBlockSize) {
+                        break;
+                    }
+                    matches &= ~uint64_t(0) << (first + length);
+                }
+                index = blockBegin + MatchBlockSize;
+            }
+            if (runBegin != runEnd) {
+                run(runBegin, runEnd);
+            }
+        }
+
+        /**
+         * Picks the smallest packed slot list among the requested
+         * components, iterating it only visits entities that has
+         * that component. nullptr if no component keeps such a list.
+         */
+        template<typename... TSystemComponents>
+        const std::vector<size_t> *GetDrivingSlots() const {
+            const std::vector<size_t> *driver = nullptr;
+            TupleTypes<RequiredComponents<TSystemComponents...>>::Apply([&]<typename... TRequired>() {
+                ([&] {
+                    if constexpr (SlotListStorage<StorageFor<TRequired>>) {
+                        const auto &slots = GetStorage<TRequired>().Slots();
+                        if (!driver || slots.size() < driver->size()) {
+                            driver = &slots;
+                        }
+                    }
+                }(), ...);
+            });
+            return driver;
         }
 
         template<typename TEntityComponent>
         void UpdateComponentRange(const EntityID &entityId) {
-            if (!HasInternal<TEntityComponent>(entityId)) {
+            if (!HasInternal<TEntityComponent>(entityId.GetId())) {
                 throw std::logic_error("Not a valid id!");
             }
             auto &componentRange = std::get<ComponentRange<TEntityComponent>>(componentRanges);
-            if (!componentRange.componentPresent) {
-                componentRange.componentPresent = true;
-                componentRange.firstSlot = std::min(entityId.GetId(), componentRange.firstSlot);
-                componentRange.lastSlot = std::max(entityId.GetId(), componentRange.lastSlot);
-            } else {
-                componentRange.lastSlot = entityId.GetId();
+            componentRange.componentPresent = true;
+            componentRange.count++;
+            componentRange.firstSlot = std::min<size_t>(entityId.GetId(), componentRange.firstSlot);
+            componentRange.lastSlot = std::max<size_t>(entityId.GetId(), componentRange.lastSlot);
+        }
+
+        /**
+         * Clears the component from the slot, and tightens the range
+         * of the component if the slot was at one of its ends.
+         */
+        template<typename TEntityComponent>
+        void EraseComponent(size_t slot) {
+            auto &bitmap = occupancy[ComponentBit<TEntityComponent>()];
+            signatures[slot].Reset(ComponentBit<TEntityComponent>());
+            bitmap.Reset(slot);
+            GetStorage<TEntityComponent>().Erase(slot);
+
+            auto &componentRange = std::get<ComponentRange<TEntityComponent>>(componentRanges);
+            if (--componentRange.count == 0) {
+                componentRange = {};
+                return;
+            }
+            if (slot == componentRange.firstSlot) {
+                componentRange.firstSlot = bitmap.FindNext(slot);
+            }
+            if (slot == componentRange.lastSlot) {
+                componentRange.lastSlot = bitmap.FindPrevious(slot);
             }
         }
 
+        /**
+         * Intersects the ranges of the required components. Returns
+         * nullopt if any of them has no instances or the ranges does
+         * not overlap, in which case no entity can match.
+         */
         template<typename... TSystemComponents>
-        std::optional<ComponentRangesMatch> GetSystemFilterMatch() {
-            bool found = false;
+        std::optional<ComponentRangesMatch> GetSystemFilterMatch() const {
+            if (ContainerSize() == 0) {
+                return std::nullopt;
+            }
             size_t firstSlot = 0;
-            size_t lastSlot = SIZE_MAX;
-
-            std::apply([&] <typename... TComponentRange> (TComponentRange&&... args) {
-                (((ComponentTypeInPack<TComponentRange, TSystemComponents ...>() && args.componentPresent) ? found = true : 0), ...);
-                (((ComponentTypeInPack<TComponentRange, TSystemComponents ...>() && args.componentPresent) ? firstSlot = std::max(args.firstSlot, firstSlot) : 0), ...);
-                (((ComponentTypeInPack<TComponentRange, TSystemComponents ...>() && args.componentPresent) ? lastSlot = std::min(args.lastSlot, lastSlot) : 0), ...);
-            }, componentRanges);
-            if (!found) {
+            size_t lastSlot = ContainerSize() - 1;
+            bool present = TupleTypes<RequiredComponents<TSystemComponents...>>::Apply([&]<typename... TRequired>() {
+                return ([&] {
+                    const auto &componentRange = std::get<ComponentRange<TRequired>>(componentRanges);
+                    firstSlot = std::max(componentRange.firstSlot, firstSlot);
+                    lastSlot = std::min(componentRange.lastSlot, lastSlot);
+                    return componentRange.componentPresent;
+                }() && ...);
+            });
+            if (!present || firstSlot > lastSlot) {
                 return std::nullopt;
             }
             return ComponentRangesMatch{firstSlot, lastSlot};
         }
 
         template<TypeIn<TComponents...> TEntityComponent>
-        [[nodiscard]] bool HasInternal(const EntityID &entityId) const {
-            return std::get<AvailableComponent<TEntityComponent>>(entities[entityId.GetId()].activeComponents).active;
+        [[nodiscard]] bool HasInternal(size_t slot) const {
+            return signatures[slot].Test(ComponentBit<TEntityComponent>());
         }
 
-        template<typename TEntityComponent>
-        [[nodiscard]] AvailableComponent<TEntityComponent> &GetComponent(const EntityID &entityId) {
-            return std::get<AvailableComponent<TEntityComponent>>(GetEntity(entityId.GetId()).activeComponents);
+        [[nodiscard]] inline bool IsActive(size_t slot) const {
+            return signatures[slot].Test(AliveBit);
         }
 
-        [[nodiscard]] inline Entity &GetEntity(size_t index) {
-            ValidateID(index);
-            return entities[index];
+        template<TypeIn<TComponents...> TComponent>
+        [[nodiscard]] TComponent &GetComponentData(const EntityID &entityId) {
+            ValidateID(entityId.GetId());
+            return GetStorage<TComponent>().Get(entityId.GetId());
         }
 
-        template<typename TEntityComponent>
-        [[nodiscard]] const AvailableComponent<TEntityComponent> &ReadComponent(const EntityID &entityId) const {
-            return std::get<AvailableComponent<TEntityComponent>>(entities[entityId.GetId()].activeComponents);
+        template<TypeIn<TComponents...> TComponent>
+        [[nodiscard]] const TComponent &GetComponentData(const EntityID &entityId) const {
+            ValidateID(entityId.GetId());
+            return GetStorage<TComponent>().Get(entityId.GetId());
         }
 
         template<TypeIn<TComponents...> TComponent>
-        [[nodiscard]] TComponent &GetComponentData(const EntityID &entityId) {
-            ValidateID(entityId.GetId());
-            return GetComponentDataArray<TComponent>()[entityId.GetId()];
+        [[nodiscard]] StorageFor<TComponent> &GetStorage() {
+            return std::get<StorageFor<TComponent>>(componentStorages);
         }
 
         template<TypeIn<TComponents...> TComponent>
-        [[nodiscard]] ComponentArray<TComponent> &GetComponentDataArray() {
-            return std::get<ComponentArray<TComponent>>(componentArrays);
+        [[nodiscard]] const StorageFor<TComponent> &GetStorage() const {
+            return std::get<StorageFor<TComponent>>(componentStorages);
+        }
+
+        /**
+         * Returns the cache of the query with the given masks,
+         * registering it and filling it with the current matches
+         * the first time the masks are asked for.
+         * @param masks the signature masks of the query.
+         * @return const QueryCache& the cache, valid for as long as
+         * the ECSManager.
+         */
+        const QueryCache &RegisterQuery(const QueryMasks &masks) {
+            for (const auto &cache: queries) {
+                if (cache.masks.mask == masks.mask && cache.masks.expected == masks.expected) {
+                    return cache;
+                }
+            }
+            auto &cache = queries.emplace_back(masks);
+            for (size_t slot = 0; slot < endSlot; slot++) {
+                cache.Update(slot, signatures[slot]);
+            }
+            return cache;
+        }
+
+        /**
+         * Moves the slot in or out of the registered queries after
+         * its signature changed.
+         */
+        void UpdateQueries(size_t slot) {
+            for (auto &cache: queries) {
+                cache.Update(slot, signatures[slot]);
+            }
+        }
+
+        /**
+         * Removes all components of the entity in the given slot,
+         * releasing the storage they hold.
+         */
+        void ClearComponents(size_t slot) {
+            ([&] {
+                if (HasInternal<TComponents>(slot)) {
+                    EraseComponent<TComponents>(slot);
+                }
+            }(), ...);
+            signatures[slot].Clear();
         }
 
         inline void ValidateID(size_t index) const {
@@ -430,76 +1581,211 @@ namespace ecs {
             }
         }
 
+        /**
+         * O(1) liveness check, the id has to point to a active slot
+         * and carry the current generation of that slot.
+         */
+        [[nodiscard]] inline bool IsAlive(const EntityID &id) const {
+            if (id.GetId() >= entities.size()) {
+                return false;
+            }
+            return IsActive(id.GetId()) && entities[id.GetId()] == id;
+        }
+
+        inline void ValidateAlive(const EntityID &id) const {
+            ValidateEntityID(id);
+            if (!IsAlive(id)) {
+                throw std::invalid_argument("Entity not alive, the id is stale or unknown.");
+            }
+        }
+
+        /**
+         * Pops the lowest free slot from the free list, then a slot
+         * recycled for reservations, or returns entities.size() if
+         * there are no holes to fill. Only called right after
+         * CommitReserved, so none of the recycled slots are taken.
+         */
         size_t GetFirstEmptySlot() {
-            size_t slot = 0;
-            while (slot < endSlot && entities[slot].active) {
-                slot++;
+            if (!freeSlots.empty()) {
+                auto slot = freeSlots.top();
+                freeSlots.pop();
+                return slot;
             }
-            if (slot == endSlot) {
-                endSlot++;
+            if (!recycledSlots.empty()) {
+                auto slot = recycledSlots.back();
+                recycledSlots.pop_back();
+                recycledEnd.value = recycledSlots.size();
+                return slot;
             }
-            return slot;
+            return entities.size();
         }
 
-        [[nodiscard]] size_t GetLastSlot() const {
-            if (endSlot == 0) {
-                return 0;
+        /**
+         * Hands a slot back to the free list and shrinks endSlot
+         * past all trailing inactive slots.
+         */
+        void ReleaseSlot(size_t slot) {
+            freeSlots.push(slot);
+            while (endSlot > 0 && !IsActive(endSlot - 1)) {
+                endSlot--;
+            }
+        }
+
+        /**
+         * Makes a reserved slot a alive entity.
+         */
+        void CreateReserved(size_t slot) {
+            signatures[slot].Set(AliveBit);
+            UpdateQueries(slot);
+            if constexpr ((std::is_same<EntityID, TComponents>::value || ...)) {
+                Add<EntityID>(entities[slot], entities[slot]);
+            }
+            endSlot = std::max(endSlot, slot + 1);
+        }
+
+        /**
+         * Atomic counter that can be copied along with the ECSManager.
+         */
+        struct ReservationCounter {
+            ReservationCounter() = default;
+
+            ReservationCounter(const ReservationCounter &other) : value(other.value.load()) {}
+
+            ReservationCounter &operator=(const ReservationCounter &other) {
+                value = other.value.load();
+                return *this;
+            }
+
+            std::atomic<size_t> value = 0;
+        };
+
+        /**
+         * Reserves count slots, the recycled slots first from the
+         * back of recycledSlots, then new slots by moving the
+         * reservation counter without going past the slots a id
+         * can address.
+         * @param reserved called with the id of every reserved slot.
+         */
+        template<typename TFunction>
+        void ReserveSlots(size_t count, TFunction &&reserved) {
+            auto recycled = recycledEnd.value.load();
+            size_t nrRecycled;
+            do {
+                nrRecycled = std::min(count, recycled);
+            } while (!recycledEnd.value.compare_exchange_weak(recycled, recycled - nrRecycled));
+            for (auto index = recycled; index > recycled - nrRecycled; index--) {
+                reserved(entities[recycledSlots[index - 1]]);
+            }
+
+            auto nrNew = count - nrRecycled;
+            auto first = reservedEnd.value.load();
+            do {
+                if (nrNew > EntityID::MaxSlots - first) {
+                    throw std::length_error("Out of entity ids!");
+                }
+            } while (!reservedEnd.value.compare_exchange_weak(first, first + nrNew));
+            for (auto slot = first; slot < first + nrNew; slot++) {
+                reserved(EntityID(slot));
+            }
+        }
+
+        /**
+         * Adds never used slots up to nrSlots to every per slot
+         * array, the new slots are inactive.
+         */
+        void GrowSlots(size_t nrSlots) {
+            if (nrSlots > EntityID::MaxSlots) {
+                throw std::length_error("Out of entity ids!");
+            }
+            for (auto slot = entities.size(); slot < nrSlots; slot++) {
+                entities.push_back(EntityID(slot));
+            }
+            signatures.resize(nrSlots);
+            std::apply([&](auto &&...args) { ((args.Resize(nrSlots)), ...); }, componentStorages);
+            for (auto &bitmap: occupancy) {
+                bitmap.Resize(nrSlots);
             }
-            return endSlot - 1;
         }
 
         size_t endSlot = 0;
         size_t nrEntities = 0;
+        /**
+         * One past the last slot handed out, by AddEntity or by a
+         * reservation. Slots between entities.size() and it are
+         * reserved but not yet created.
+         */
+        ReservationCounter reservedEnd;
         EntitiesSlots entities;
-        ComponentMatrix componentArrays{};
+        SignatureSlots signatures;
+        ComponentOccupancy occupancy;
+        /**
+         * Inactive slots, other than the recycled ones, that
+         * AddEntity fills lowest first.
+         */
+        std::priority_queue<size_t, std::vector<size_t>, std::greater<>> freeSlots;
+        /**
+         * Slots moved from freeSlots at each commit, reservations
+         * take them from the back, so the lowest go first. The first
+         * recycledEnd are still free, the rest are reserved.
+         */
+        std::vector<size_t> recycledSlots;
+        ReservationCounter recycledEnd;
+        ComponentStorages componentStorages{};
         ComponentRanges componentRanges{};
+        std::deque<QueryCache> queries;
+        Tick currentTick = 1;
     };
 
     template<typename... TComponents>
     requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
     constexpr EntityID ECSManager<TComponents...>::AddEntity() {
+        CommitReserved();
         auto slot = GetFirstEmptySlot();
         if (slot == entities.size()) {
-            entities.push_back({.id=EntityID(slot)});
-            std::apply([](auto &&...args) { ((PushToVector(args)), ...); }, componentArrays);
+            GrowSlots(slot + 1);
+            reservedEnd.value = entities.size();
         }
-        auto &entity = GetEntity(slot);
-        entity.active = true;
-        std::apply([](auto &&...args) { ((args.active = false), ...); }, entity.activeComponents);
+        endSlot = std::max(endSlot, slot + 1);
+        signatures[slot].Set(AliveBit);
+        UpdateQueries(slot);
         nrEntities++;
+        auto id = entities[slot];
         if constexpr ((std::is_same<EntityID, TComponents>::value || ...)) {
-            Add<EntityID>(entity.id, entity.id);
+            Add<EntityID>(id, id);
         }
-        return entity.id;
+        return id;
     }
 
     template<typename... TComponents>
     requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
     template<typename TComponent>
     requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
-    constexpr void ECSManager<TComponents...>::Add(const EntityID &entityId, const TComponent &component) {
-        ValidateEntityID(entityId);
-        auto &isActive = GetComponent<TComponent>(entityId).active;
-        if (isActive) {
+    constexpr void ECSManager<TComponents...>::Add(const EntityID &entityId, TComponent component) {
+        ValidateAlive(entityId);
+        auto slot = entityId.GetId();
+        if (HasInternal<TComponent>(slot)) {
             throw std::logic_error("Component already added!");
         }
-        isActive = true;
-        GetComponentData<TComponent>(entityId) = component;
+        GetStorage<TComponent>().Insert(slot, std::move(component), currentTick);
+        signatures[slot].Set(ComponentBit<TComponent>());
+        occupancy[ComponentBit<TComponent>()].Set(slot);
         UpdateComponentRange<TComponent>(entityId);
+        UpdateQueries(slot);
     }
 
     template<typename... TComponents>
     requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
     constexpr void ECSManager<TComponents...>::RemoveEntity(const EntityID &entityId) {
         ValidateEntityID(entityId);
-        auto &entity = GetEntity(entityId.GetId());
-        if (!entity.active) {
+        auto slot = entityId.GetId();
+        ValidateID(slot);
+        if (!IsActive(slot) || entities[slot] != entityId) {
             throw std::logic_error("Entity not active!");
         }
-        entity.active = false;
-        if (GetLastSlot() == entity.id.GetId()) {
-            endSlot--;
-        }
+        ClearComponents(slot);
+        UpdateQueries(slot);
+        entities[slot] = entityId.NextGeneration();
+        ReleaseSlot(slot);
         nrEntities--;
     }
 
@@ -508,12 +1794,13 @@ namespace ecs {
     template<typename TComponent>
     requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
     constexpr void ECSManager<TComponents...>::Remove(const EntityID &entityId) {
-        ValidateEntityID(entityId);
-        auto &isActive = GetComponent<TComponent>(entityId).active;
-        if (!isActive) {
+        ValidateAlive(entityId);
+        auto slot = entityId.GetId();
+        if (!HasInternal<TComponent>(slot)) {
             throw std::logic_error("Component not active!");
         }
-        isActive = false;
+        EraseComponent<TComponent>(slot);
+        UpdateQueries(slot);
     }
 
     template<typename... TComponents>
@@ -523,7 +1810,7 @@ namespace ecs {
         if (entityId.GetId() >= entities.size()) {
             throw std::out_of_range("Trying to access out of bounds!");
         }
-        return entities[entityId.GetId()].active;
+        return IsAlive(entityId);
     }
 
     template<typename... TComponents>
@@ -532,7 +1819,7 @@ namespace ecs {
     requires NonVoidArgs<TEntityComponents...>
     constexpr bool ECSManager<TComponents...>::Has(const EntityID &entityId) const {
         ValidateEntityID(entityId);
-        return (HasInternal<TEntityComponents>(entityId) && ...);
+        return IsAlive(entityId) && signatures[entityId.GetId()].Contains(ComponentMask<TEntityComponents...>);
     }
 
     template<typename... TComponents>
@@ -540,8 +1827,21 @@ namespace ecs {
     template<typename TComponent>
     requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
     constexpr TComponent &ECSManager<TComponents...>::Get(const EntityID &entityId) {
-        ValidateEntityID(entityId);
-        if (!ReadComponent<TComponent>(entityId).active) {
+        ValidateAlive(entityId);
+        if (!HasInternal<TComponent>(entityId.GetId())) {
+            throw std::invalid_argument("Bad access, component not present on this entity.");
+        }
+        GetStorage<TComponent>().SetChanged(entityId.GetId(), currentTick);
+        return GetComponentData<TComponent>(entityId);
+    }
+
+    template<typename... TComponents>
+    requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
+    template<typename TComponent>
+    requires NonVoidArgs<TComponents...> && TypeIn<TComponent, TComponents...>
+    constexpr const TComponent &ECSManager<TComponents...>::Get(const EntityID &entityId) const {
+        ValidateAlive(entityId);
+        if (!HasInternal<TComponent>(entityId.GetId())) {
             throw std::invalid_argument("Bad access, component not present on this entity.");
         }
         return GetComponentData<TComponent>(entityId);
@@ -550,7 +1850,7 @@ namespace ecs {
     template<typename... TComponents>
     requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
     template<typename ... TSystemComponents>
-    requires NonVoidArgs<TSystemComponents...> && (TypeIn<TSystemComponents, TComponents...> && ...)
+    requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
     constexpr typename ECSManager<TComponents...>::template System<TSystemComponents...> ECSManager<TComponents...>::GetSystem() {
         return GetSystemPart<TSystemComponents...>(0, 1);
     }
@@ -558,9 +1858,17 @@ namespace ecs {
     template<typename... TComponents>
     requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
     template<typename ... TSystemComponents>
-    requires NonVoidArgs<TSystemComponents...> && (TypeIn<TSystemComponents, TComponents...> && ...)
-    constexpr typename ECSManager<TComponents...>::template System<TSystemComponents...> ECSManager<TComponents...>::GetSystemPart(size_t part, size_t totalParts) {
-        return System<TSystemComponents...>(*this, part, totalParts);
+    requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+    constexpr typename ECSManager<TComponents...>::template System<TSystemComponents...> ECSManager<TComponents...>::GetSystemPart(size_t part, size_t totalParts, Partition partition) {
+        return System<TSystemComponents...>(*this, part, totalParts, partition);
+    }
+
+    template<typename... TComponents>
+    requires NonVoidArgs<TComponents...> && IsBasicType<TComponents...>
+    template<typename... TSystemComponents, typename TFunction>
+    requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+    void ECSManager<TComponents...>::ForEach(TFunction &&function) {
+        GetSystem<TSystemComponents...>().ForEach(std::forward<TFunction>(function));
     }
 
     template<typename... TComponents>
@@ -17,6 +17,13 @@ constexpr bool ComponentTypeInPack() {
     return (std::same_as<typename std::remove_cvref_t<TypeToCheck>::TComponentRange, TypesToCheckAgainst> || ...);
 }
 
+template<typename TypeToFind, typename... TypesToSearch>
+constexpr size_t IndexInPack() {
+    size_t index = 0;
+    ((std::same_as<std::remove_cvref_t<TypeToFind>, TypesToSearch> ? false : (++index, true)) && ...);
+    return index;
+}
+
 template <typename... Args>
 concept NonVoidArgs = sizeof...(Args) > 0;
 
@@ -28,8 +35,3 @@ concept IsBasicType = ((
         not std::is_const_v<TComponent> &&
         not std::is_volatile_v<TComponent>) &&
         ...);
-
-template <typename T>
-void PushToVector(std::vector<T>& vector) {
-    vector.push_back(T{});
-}
@@ -10,27 +10,71 @@ namespace ecs {
     /**
      * EntityID
      * Id reference to a entity.
+     * Packs the slot index of the entity together with the
+     * generation of that slot into one 64 bit handle. The
+     * generation is bumped every time the slot is freed, so a
+     * stale id never aliases a entity that reuses its slot.
      */
     class EntityID {
     public:
-        using ID = size_t;
+        using ID = uint32_t;
+        using Generation = uint32_t;
+        using Handle = uint64_t;
+
+        /**
+         * Number of slots a id can address, the last index is kept
+         * for invalid ids.
+         */
+        static constexpr size_t MaxSlots = UINT32_MAX;
 
         constexpr EntityID() = default;
 
-        constexpr EntityID(ID id)
-                : id(id) {
+        constexpr EntityID(ID id, Generation generation = 0)
+                : handle(Pack(id, generation)) {
+        }
+
+        /**
+         * Slot index of the entity.
+         */
+        [[nodiscard]] constexpr EntityID::ID GetId() const {
+            return static_cast<ID>(handle & IndexMask);
+        }
+
+        /**
+         * Generation of the slot when this id was handed out.
+         */
+        [[nodiscard]] constexpr EntityID::Generation GetGeneration() const {
+            return static_cast<Generation>(handle >> GenerationShift);
         }
 
-        [[nodiscard]] constexpr const EntityID::ID &GetId() const {
-            return id;
+        /**
+         * The packed index and generation.
+         */
+        [[nodiscard]] constexpr EntityID::Handle GetHandle() const {
+            return handle;
         }
 
-        friend constexpr bool operator==(const EntityID &a, const EntityID &b) { return a.id == b.id; };
+        /**
+         * Returns a id to the same slot with the next generation.
+         */
+        [[nodiscard]] constexpr EntityID NextGeneration() const {
+            return {GetId(), GetGeneration() + 1};
+        }
+
+        friend constexpr bool operator==(const EntityID &a, const EntityID &b) { return a.handle == b.handle; };
 
-        constexpr operator bool() const { return id != SIZE_MAX; }
+        constexpr operator bool() const { return GetId() != InvalidID; }
 
     private:
-        ID id = SIZE_MAX;
+        static constexpr ID InvalidID = UINT32_MAX;
+        static constexpr Handle IndexMask = UINT32_MAX;
+        static constexpr size_t GenerationShift = 32;
+
+        static constexpr Handle Pack(ID id, Generation generation) {
+            return static_cast<Handle>(generation) << GenerationShift | id;
+        }
+
+        Handle handle = Pack(InvalidID, 0);
     };
 
-}
\ No newline at end of file
+}
@@ -0,0 +1,120 @@
+//
+// Created by Stefan Annell on 2024-02-24.
+//
+
+#pragma once
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <bit>
+
+namespace ecs {
+    /**
+     * OccupancyBitmap
+     * A two level bitmap over the entity slots, one bit per slot
+     * telling if it is occupied. The summary level has one bit per
+     * 64 slot word, set if that word has any bit set, so a empty
+     * region of 4096 slots is skipped by looking at a single word.
+     */
+    class OccupancyBitmap {
+    public:
+        static constexpr size_t BitsPerWord = 64;
+        static constexpr size_t SlotsPerSummaryWord = BitsPerWord * BitsPerWord;
+
+        void Resize(size_t nrSlots) {
+            words.resize((nrSlots + BitsPerWord - 1) / BitsPerWord);
+            summary.resize((words.size() + BitsPerWord - 1) / BitsPerWord);
+        }
+
+        void Set(size_t slot) {
+            auto word = slot / BitsPerWord;
+            words[word] |= Bit(slot);
+            summary[word / BitsPerWord] |= Bit(word);
+        }
+
+        void Reset(size_t slot) {
+            auto word = slot / BitsPerWord;
+            words[word] &= ~Bit(slot);
+            if (!words[word]) {
+                summary[word / BitsPerWord] &= ~Bit(word);
+            }
+        }
+
+        [[nodiscard]] bool Test(size_t slot) const {
+            return words[slot / BitsPerWord] & Bit(slot);
+        }
+
+        /**
+         * The occupancy of slots [word * 64, word * 64 + 64).
+         */
+        [[nodiscard]] uint64_t Word(size_t word) const {
+            return words[word];
+        }
+
+        /**
+         * Which of the words [index * 64, index * 64 + 64) that
+         * has any slot occupied.
+         */
+        [[nodiscard]] uint64_t SummaryWord(size_t index) const {
+            return summary[index];
+        }
+
+        /**
+         * Finds the first occupied slot at or after the given slot.
+         * @return size_t the slot, SIZE_MAX if there is none.
+         */
+        [[nodiscard]] size_t FindNext(size_t slot) const {
+            auto word = slot / BitsPerWord;
+            if (word >= words.size()) {
+                return SIZE_MAX;
+            }
+            auto bits = words[word] & (~uint64_t(0) << (slot % BitsPerWord));
+            if (bits) {
+                return word * BitsPerWord + std::countr_zero(bits);
+            }
+            for (auto index = (word + 1) / BitsPerWord; index < summary.size(); index++) {
+                auto summaryBits = summary[index];
+                if (index == (word + 1) / BitsPerWord) {
+                    summaryBits &= ~uint64_t(0) << ((word + 1) % BitsPerWord);
+                }
+                if (summaryBits) {
+                    auto next = index * BitsPerWord + std::countr_zero(summaryBits);
+                    return next * BitsPerWord + std::countr_zero(words[next]);
+                }
+            }
+            return SIZE_MAX;
+        }
+
+        /**
+         * Finds the last occupied slot at or before the given slot.
+         * @return size_t the slot, SIZE_MAX if there is none.
+         */
+        [[nodiscard]] size_t FindPrevious(size_t slot) const {
+            auto word = slot / BitsPerWord;
+            auto bits = words[word] & (~uint64_t(0) >> (BitsPerWord - 1 - slot % BitsPerWord));
+            if (bits) {
+                return word * BitsPerWord + BitsPerWord - 1 - std::countl_zero(bits);
+            }
+            for (auto index = word / BitsPerWord + 1; index-- > 0;) {
+                auto summaryBits = summary[index];
+                if (index == word / BitsPerWord) {
+                    summaryBits &= (uint64_t(1) << (word % BitsPerWord)) - 1;
+                }
+                if (summaryBits) {
+                    auto previous = index * BitsPerWord + BitsPerWord - 1 - std::countl_zero(summaryBits);
+                    return previous * BitsPerWord + BitsPerWord - 1 - std::countl_zero(words[previous]);
+                }
+            }
+            return SIZE_MAX;
+        }
+
+    private:
+        static constexpr uint64_t Bit(size_t index) {
+            return uint64_t(1) << (index % BitsPerWord);
+        }
+
+        std::vector<uint64_t> words;
+        std::vector<uint64_t> summary;
+    };
+}
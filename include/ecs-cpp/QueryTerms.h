@@ -0,0 +1,229 @@
+//
+// Created by Stefan Annell on 2024-03-09.
+//
+
+#pragma once
+
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <cstdint>
+#include "ComponentStorage.h"
+
+namespace ecs {
+    /**
+     * With
+     * Query term that requires the components without fetching
+     * them, for filter only components like tags.
+     * GetSystem<Position, With<Player>>()
+     */
+    template<typename... TComponents>
+    struct With {
+    };
+
+    /**
+     * Without
+     * Query term that skips entities that has any of the
+     * components.
+     * GetSystem<Position, Velocity, Without<Frozen>>()
+     */
+    template<typename... TComponents>
+    struct Without {
+    };
+
+    /**
+     * Maybe
+     * Query term for a optional component, fetched as a pointer to
+     * the component or nullptr if the entity does not have it.
+     * GetSystem<Position, Maybe<Modifier>>()
+     * Maybe<const Modifier> fetches a pointer to const.
+     */
+    template<typename TComponent>
+    struct Maybe {
+    };
+
+    /**
+     * Changed
+     * Query term that requires the component and only matches
+     * entities where it was added or mutably accessed after the
+     * tick given to System::Since. Tags keep no ticks and can
+     * not be filtered on.
+     * GetSystem<Position, Changed<Position>>().Since(lastRun)
+     */
+    template<typename TComponent>
+    struct Changed {
+    };
+
+    /**
+     * Added
+     * Query term that requires the component and only matches
+     * entities where it was added after the tick given to
+     * System::Since. Tags keep no ticks and can not be filtered on.
+     * GetSystem<Position, Added<Position>>().Since(lastRun)
+     */
+    template<typename TComponent>
+    struct Added {
+    };
+
+    /**
+     * Entity
+     * Query term that fetches the EntityID of the matching entity,
+     * read from the entity slots rather than a component.
+     * GetSystem<Entity, Position>()
+     */
+    struct Entity {
+    };
+
+    /**
+     * QueryTerm
+     * Describes how a term in a query is matched and fetched. A
+     * plain component is required and fetched as a reference, a
+     * const component as a const reference.
+     * Components: every component the term refers to.
+     * Required: components the entity has to have.
+     * Excluded: components the entity can not have.
+     * Fetched: what is handed out for each matching entity.
+     * Written: components the term hands out mutable access to.
+     * ChangedSince: components that has to have changed after the
+     * tick of the system.
+     * AddedSince: components that has to have been added after the
+     * tick of the system.
+     * IsComponent: if the term is fetched as a component reference.
+     * IsReadOnly: if the term never hands out mutable access.
+     * @tparam TTerm the term.
+     */
+    template<typename TTerm>
+    struct QueryTerm {
+        using Components = std::tuple<std::remove_const_t<TTerm>>;
+        using Required = std::tuple<std::remove_const_t<TTerm>>;
+        using Excluded = std::tuple<>;
+        using Fetched = std::tuple<TTerm>;
+        using Written = std::conditional_t<std::is_const_v<TTerm>, std::tuple<>, std::tuple<TTerm>>;
+        using ChangedSince = std::tuple<>;
+        using AddedSince = std::tuple<>;
+        static constexpr bool IsComponent = true;
+        static constexpr bool IsReadOnly = std::is_const_v<TTerm>;
+    };
+
+    template<typename... TComponents>
+    struct QueryTerm<With<TComponents...>> {
+        using Components = std::tuple<TComponents...>;
+        using Required = std::tuple<TComponents...>;
+        using Excluded = std::tuple<>;
+        using Fetched = std::tuple<>;
+        using Written = std::tuple<>;
+        using ChangedSince = std::tuple<>;
+        using AddedSince = std::tuple<>;
+        static constexpr bool IsComponent = false;
+        static constexpr bool IsReadOnly = true;
+    };
+
+    template<typename... TComponents>
+    struct QueryTerm<Without<TComponents...>> {
+        using Components = std::tuple<TComponents...>;
+        using Required = std::tuple<>;
+        using Excluded = std::tuple<TComponents...>;
+        using Fetched = std::tuple<>;
+        using Written = std::tuple<>;
+        using ChangedSince = std::tuple<>;
+        using AddedSince = std::tuple<>;
+        static constexpr bool IsComponent = false;
+        static constexpr bool IsReadOnly = true;
+    };
+
+    template<typename TComponent>
+    struct QueryTerm<Maybe<TComponent>> {
+        using Components = std::tuple<std::remove_const_t<TComponent>>;
+        using Required = std::tuple<>;
+        using Excluded = std::tuple<>;
+        using Fetched = std::tuple<Maybe<TComponent>>;
+        using Written = std::conditional_t<std::is_const_v<TComponent>, std::tuple<>, std::tuple<TComponent>>;
+        using ChangedSince = std::tuple<>;
+        using AddedSince = std::tuple<>;
+        static constexpr bool IsComponent = false;
+        static constexpr bool IsReadOnly = std::is_const_v<TComponent>;
+    };
+
+    template<typename TComponent>
+    struct QueryTerm<Changed<TComponent>> {
+        static_assert(StoragePolicy<TComponent>::value != StorageType::Tag, "Tags has no ticks to filter on!");
+        using Components = std::tuple<TComponent>;
+        using Required = std::tuple<TComponent>;
+        using Excluded = std::tuple<>;
+        using Fetched = std::tuple<>;
+        using Written = std::tuple<>;
+        using ChangedSince = std::tuple<TComponent>;
+        using AddedSince = std::tuple<>;
+        static constexpr bool IsComponent = false;
+        static constexpr bool IsReadOnly = true;
+    };
+
+    template<typename TComponent>
+    struct QueryTerm<Added<TComponent>> {
+        static_assert(StoragePolicy<TComponent>::value != StorageType::Tag, "Tags has no ticks to filter on!");
+        using Components = std::tuple<TComponent>;
+        using Required = std::tuple<TComponent>;
+        using Excluded = std::tuple<>;
+        using Fetched = std::tuple<>;
+        using Written = std::tuple<>;
+        using ChangedSince = std::tuple<>;
+        using AddedSince = std::tuple<TComponent>;
+        static constexpr bool IsComponent = false;
+        static constexpr bool IsReadOnly = true;
+    };
+
+    template<>
+    struct QueryTerm<Entity> {
+        using Components = std::tuple<>;
+        using Required = std::tuple<>;
+        using Excluded = std::tuple<>;
+        using Fetched = std::tuple<Entity>;
+        using Written = std::tuple<>;
+        using ChangedSince = std::tuple<>;
+        using AddedSince = std::tuple<>;
+        static constexpr bool IsComponent = false;
+        static constexpr bool IsReadOnly = true;
+    };
+
+    /**
+     * QueryTerms
+     * The terms of a query combined.
+     * @tparam TTerms the terms of the query.
+     */
+    template<typename... TTerms>
+    struct QueryTerms {
+        using Required = decltype(std::tuple_cat(std::declval<typename QueryTerm<TTerms>::Required>()...));
+        using Excluded = decltype(std::tuple_cat(std::declval<typename QueryTerm<TTerms>::Excluded>()...));
+        using Fetched = decltype(std::tuple_cat(std::declval<typename QueryTerm<TTerms>::Fetched>()...));
+        using Written = decltype(std::tuple_cat(std::declval<typename QueryTerm<TTerms>::Written>()...));
+        using ChangedSince = decltype(std::tuple_cat(std::declval<typename QueryTerm<TTerms>::ChangedSince>()...));
+        using AddedSince = decltype(std::tuple_cat(std::declval<typename QueryTerm<TTerms>::AddedSince>()...));
+        static constexpr bool HasTickFilter = std::tuple_size_v<ChangedSince> + std::tuple_size_v<AddedSince> > 0;
+        static constexpr bool IsReadOnly = (QueryTerm<TTerms>::IsReadOnly && ...);
+    };
+
+    /**
+     * Calls function.template operator()<Ts...>() with the types
+     * of the tuple, to expand a tuple type into a pack.
+     */
+    template<typename TTuple>
+    struct TupleTypes;
+
+    template<typename... Ts>
+    struct TupleTypes<std::tuple<Ts...>> {
+        template<typename TFunction>
+        static constexpr decltype(auto) Apply(TFunction &&function) {
+            return function.template operator()<Ts...>();
+        }
+    };
+
+    /**
+     * Checks that every component a term refers to is one of the
+     * components in the pack.
+     */
+    template<typename TTerm, typename... TComponents>
+    concept QueryTermIn = TupleTypes<typename QueryTerm<TTerm>::Components>::Apply(
+            []<typename... TTermComponents>() {
+                return (TypeInPack<TTermComponents, TComponents...>() && ...);
+            });
+}
@@ -0,0 +1,148 @@
+//
+// Created by Stefan Annell on 2024-04-13.
+//
+
+#pragma once
+
+#include <vector>
+#include <bitset>
+#include <functional>
+#include <algorithm>
+#include "EcsCpp.h"
+#include "ThreadPool.h"
+
+namespace ecs {
+    /**
+     * Scheduler
+     * Runs a set of systems on a ECSManager, running systems that
+     * do not conflict at the same time. The components a system
+     * reads and writes are taken from its query terms, a const
+     * component is read and a non const component is written.
+     * Two systems conflict if one writes a component the other
+     * reads or writes. Systems are placed in stages in the order
+     * they are added, each system after every earlier system it
+     * conflicts with, and the systems of a stage run in parallel
+     * on the thread pool.
+     * ecs::Scheduler scheduler(ecs);
+     * scheduler.Add<Position, const Velocity>([](Position &pos, const Velocity &vel) {...});
+     * scheduler.Run();
+     * @tparam TManager the ECSManager the systems run on.
+     */
+    template<typename TManager>
+    class Scheduler;
+
+    template<typename... TComponents>
+    class Scheduler<ECSManager<TComponents...>> {
+    private:
+        using TECSManager = ECSManager<TComponents...>;
+        using Access = std::bitset<sizeof...(TComponents)>;
+
+        template<typename TTuple>
+        static Access MakeAccess() {
+            return TupleTypes<TTuple>::Apply([]<typename... TAccessed>() {
+                Access access;
+                (access.set(IndexInPack<TAccessed, TComponents...>()), ...);
+                return access;
+            });
+        }
+
+        struct ScheduledSystem {
+            Access reads;
+            Access writes;
+            std::function<void()> run;
+        };
+
+    public:
+        explicit Scheduler(TECSManager &ecs, ThreadPool &pool = ThreadPool::Global()) : ecs(ecs), pool(pool) {}
+
+        /**
+         * Adds a system that runs over the entities matching the
+         * given components and query terms. It is placed after
+         * every earlier added system it conflicts with.
+         * @tparam TSystemComponents the components and query terms
+         * of the system, const for components it only reads.
+         * @param function called as function(System<TSystemComponents...> &)
+         * if it takes the system, otherwise for every matching entity
+         * as in ECSManager::ForEach.
+         */
+        template<typename... TSystemComponents, typename TFunction>
+        requires NonVoidArgs<TSystemComponents...> && (QueryTermIn<TSystemComponents, TComponents...> && ...)
+        void Add(TFunction &&function) {
+            using Terms = QueryTerms<TSystemComponents...>;
+            ScheduledSystem system;
+            system.reads = (MakeAccess<typename QueryTerm<TSystemComponents>::Components>() | ...);
+            system.writes = MakeAccess<typename Terms::Written>();
+            system.run = [&ecs = ecs, function = std::forward<TFunction>(function)]() mutable {
+                auto entities = ecs.template GetSystem<TSystemComponents...>();
+                if constexpr (std::is_invocable_v<decltype(function) &, decltype(entities) &>) {
+                    function(entities);
+                } else {
+                    entities.ForEach(function);
+                }
+            };
+
+            size_t stage = 0;
+            for (size_t index = 0; index < systems.size(); index++) {
+                if (Conflicts(systems[index], system)) {
+                    stage = std::max(stage, stageOf[index] + 1);
+                }
+            }
+            if (stage == stages.size()) {
+                stages.emplace_back();
+            }
+            stages[stage].push_back(systems.size());
+            stageOf.push_back(stage);
+            systems.push_back(std::move(system));
+        }
+
+        /**
+         * Runs every system once, stage by stage. Returns when all
+         * systems are done. Entities and components can not be added
+         * or removed by the systems.
+         */
+        void Run() {
+            for (const auto &stage: stages) {
+                if (stage.size() == 1) {
+                    systems[stage.front()].run();
+                    continue;
+                }
+                pool.ParallelFor(0, stage.size(), 1, [&](size_t first, size_t last) {
+                    for (auto index = first; index < last; index++) {
+                        systems[stage[index]].run();
+                    }
+                });
+            }
+        }
+
+        /**
+         * The systems of each stage, by the order they were added.
+         */
+        [[nodiscard]] const std::vector<std::vector<size_t>> &GetStages() const {
+            return stages;
+        }
+
+        /**
+         * Number of systems added.
+         */
+        [[nodiscard]] size_t Size() const {
+            return systems.size();
+        }
+
+    private:
+        static bool Conflicts(const ScheduledSystem &a, const ScheduledSystem &b) {
+            return (a.writes & (b.reads | b.writes)).any() || (b.writes & a.reads).any();
+        }
+
+        TECSManager &ecs;
+        ThreadPool &pool;
+        std::vector<ScheduledSystem> systems;
+        std::vector<size_t> stageOf;
+        std::vector<std::vector<size_t>> stages;
+    };
+
+    template<typename... TComponents>
+    Scheduler(ECSManager<TComponents...> &) -> Scheduler<ECSManager<TComponents...>>;
+
+    template<typename... TComponents>
+    Scheduler(ECSManager<TComponents...> &, ThreadPool &) -> Scheduler<ECSManager<TComponents...>>;
+}
@@ -0,0 +1,143 @@
+//
+// Created by Stefan Annell on 2024-02-17.
+//
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__AVX2__) || defined(__SSE4_1__)
+#include <immintrin.h>
+#endif
+
+namespace ecs {
+    /**
+     * Signature
+     * A packed bitset with one bit per component, telling which
+     * components a entity has. Unlike std::bitset it can be built
+     * and compared in constexpr, so the mask of a system can be
+     * computed at compile time.
+     * @tparam NrBits number of bits in the signature.
+     */
+    template<size_t NrBits>
+    class Signature {
+    public:
+        using Word = uint64_t;
+        static constexpr size_t BitsPerWord = 64;
+        static constexpr size_t NrWords = (NrBits + BitsPerWord - 1) / BitsPerWord;
+
+        constexpr Signature() = default;
+
+        constexpr void Set(size_t bit) {
+            words[bit / BitsPerWord] |= Word(1) << (bit % BitsPerWord);
+        }
+
+        constexpr void Reset(size_t bit) {
+            words[bit / BitsPerWord] &= ~(Word(1) << (bit % BitsPerWord));
+        }
+
+        [[nodiscard]] constexpr bool Test(size_t bit) const {
+            return words[bit / BitsPerWord] & (Word(1) << (bit % BitsPerWord));
+        }
+
+        constexpr void Clear() {
+            words = {};
+        }
+
+        /**
+         * Checks if all bits of the mask are set in this signature.
+         * For signatures of up to 64 bits this is a single
+         * and-and-compare.
+         */
+        [[nodiscard]] constexpr bool Contains(const Signature &mask) const {
+            for (size_t i = 0; i < NrWords; i++) {
+                if ((words[i] & mask.words[i]) != mask.words[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /**
+         * Checks if the bits of this signature selected by the mask
+         * are equal to expected. Used to both require and exclude
+         * bits in one compare.
+         */
+        [[nodiscard]] constexpr bool Matches(const Signature &mask, const Signature &expected) const {
+            for (size_t i = 0; i < NrWords; i++) {
+                if ((words[i] & mask.words[i]) != expected.words[i]) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        [[nodiscard]] constexpr const std::array<Word, NrWords> &Words() const {
+            return words;
+        }
+
+        friend constexpr bool operator==(const Signature &a, const Signature &b) = default;
+
+    private:
+        std::array<Word, NrWords> words{};
+    };
+
+    /**
+     * Matches a block of contiguous signatures against a mask.
+     * Bit i of the result is set if the bits of signatures[i]
+     * selected by mask are equal to expected. Single word
+     * signatures are compared with AVX2 or SSE4.1 when the compiler
+     * targets them, anything else falls back to a scalar loop.
+     * @param signatures first signature of the block.
+     * @param count number of signatures in the block, at most 64.
+     * @param mask the bits to compare.
+     * @param expected the value the compared bits has to have.
+     * @return uint64_t bitmask of the matching signatures.
+     */
+    template<size_t NrBits>
+    [[nodiscard]] inline uint64_t MatchSignatures(const Signature<NrBits> *signatures, size_t count, const Signature<NrBits> &mask, const Signature<NrBits> &expected) {
+        uint64_t result = 0;
+        size_t i = 0;
+        if constexpr (Signature<NrBits>::NrWords == 1 && sizeof(Signature<NrBits>) == sizeof(uint64_t)) {
+            const auto *words = reinterpret_cast<const uint64_t *>(signatures);
+#if defined(__AVX2__)
+            const __m256i selected = _mm256_set1_epi64x(static_cast<long long>(mask.Words()[0]));
+            const __m256i wanted = _mm256_set1_epi64x(static_cast<long long>(expected.Words()[0]));
+            for (; i + 4 <= count; i += 4) {
+                __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(words + i));
+                __m256i equal = _mm256_cmpeq_epi64(_mm256_and_si256(block, selected), wanted);
+                result |= static_cast<uint64_t>(_mm256_movemask_pd(_mm256_castsi256_pd(equal))) << i;
+            }
+#elif defined(__SSE4_1__)
+            const __m128i selected = _mm_set1_epi64x(static_cast<long long>(mask.Words()[0]));
+            const __m128i wanted = _mm_set1_epi64x(static_cast<long long>(expected.Words()[0]));
+            for (; i + 2 <= count; i += 2) {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(words + i));
+                __m128i equal = _mm_cmpeq_epi64(_mm_and_si128(block, selected), wanted);
+                result |= static_cast<uint64_t>(_mm_movemask_pd(_mm_castsi128_pd(equal))) << i;
+            }
+#endif
+            const auto selectedWord = mask.Words()[0];
+            const auto wantedWord = expected.Words()[0];
+            for (; i < count; i++) {
+                result |= static_cast<uint64_t>((words[i] & selectedWord) == wantedWord) << i;
+            }
+        } else {
+            for (; i < count; i++) {
+                result |= static_cast<uint64_t>(signatures[i].Matches(mask, expected)) << i;
+            }
+        }
+        return result;
+    }
+
+    /**
+     * Matches a block of contiguous signatures, bit i of the result
+     * is set if signatures[i] contains all bits of mask.
+     */
+    template<size_t NrBits>
+    [[nodiscard]] inline uint64_t MatchSignatures(const Signature<NrBits> *signatures, size_t count, const Signature<NrBits> &mask) {
+        return MatchSignatures(signatures, count, mask, mask);
+    }
+}
@@ -0,0 +1,278 @@
+//
+// Created by Stefan Annell on 2024-04-06.
+//
+
+#pragma once
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
+#include <exception>
+#include "ComponentStorage.h"
+
+namespace ecs {
+    /**
+     * ThreadPool
+     * A fixed set of worker threads that runs parallel loops with
+     * work stealing. The range of a loop is split evenly between
+     * the workers and the calling thread, each takes chunks from
+     * the front of its own range. A worker that runs out steals
+     * the back half of the range of another, so the work evens
+     * out without tuning the number of parts up front.
+     * Workers are started once and sleep between loops, waiting
+     * on the loop generation.
+     */
+    class ThreadPool {
+    public:
+        /**
+         * Starts the pool.
+         * @param nrWorkers number of worker threads, the thread
+         * calling ParallelFor works as well.
+         */
+        explicit ThreadPool(size_t nrWorkers = DefaultWorkers()) {
+            for (size_t i = 0; i < nrWorkers; i++) {
+                workers.emplace_back([this, i] { WorkerLoop(i + 1); });
+            }
+        }
+
+        ~ThreadPool() {
+            stopping = true;
+            generation++;
+            generation.notify_all();
+            for (auto &worker: workers) {
+                worker.join();
+            }
+        }
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /**
+         * Number of threads taking part in a loop, the workers and
+         * the calling thread.
+         */
+        [[nodiscard]] size_t Size() const {
+            return workers.size() + 1;
+        }
+
+        /**
+         * Calls function(first, last) for chunks covering
+         * [begin, end) exactly once, in parallel. Chunk boundaries
+         * are multiples of grain, apart from begin and end. Returns
+         * when every chunk is done. Calls from within a loop of the
+         * pool, or while another thread runs a loop, run serially
+         * on the calling thread.
+         * If function throws, the chunks not yet started are
+         * skipped and the first exception is rethrown once every
+         * thread has left the loop.
+         * @param begin first index.
+         * @param end one past the last index.
+         * @param grain smallest chunk handed out.
+         * @param function called as function(size_t first, size_t last).
+         */
+        template<typename TFunction>
+        void ParallelFor(size_t begin, size_t end, size_t grain, TFunction &&function) {
+            if (begin >= end) {
+                return;
+            }
+            grain = std::max<size_t>(grain, 1);
+            std::unique_lock submit(submitMutex, std::try_to_lock);
+            if (!submit || InsideLoop() || workers.empty() || end - begin <= grain) {
+                function(begin, end);
+                return;
+            }
+
+            Loop loop(Size(), grain, function);
+            auto count = end - begin;
+            for (size_t i = 0; i < loop.ranges.size(); i++) {
+                loop.ranges[i].begin = Boundary(begin, end, begin + count * i / loop.ranges.size(), grain);
+                loop.ranges[i].end = Boundary(begin, end, begin + count * (i + 1) / loop.ranges.size(), grain);
+            }
+            loop.ranges.back().end = end;
+            current = &loop;
+            pending = workers.size();
+            generation++;
+            generation.notify_all();
+            Work(loop, 0);
+            for (auto left = pending.load(); left; left = pending.load()) {
+                pending.wait(left);
+            }
+            current = nullptr;
+            if (loop.error) {
+                std::rethrow_exception(loop.error);
+            }
+        }
+
+        /**
+         * The pool shared by ECSManager::ParallelForEach, with one
+         * worker less than the hardware has threads.
+         */
+        static ThreadPool &Global() {
+            static ThreadPool pool;
+            return pool;
+        }
+
+    private:
+        /**
+         * The part of the loop a thread has left, padded to a cache
+         * line so threads taking chunks do not contend on the line.
+         */
+        struct alignas(CacheLineSize) WorkRange {
+            std::mutex mutex;
+            size_t begin = 0;
+            size_t end = 0;
+        };
+
+        struct Loop {
+            Loop(size_t nrThreads, size_t grain, const std::function<void(size_t, size_t)> &function) : ranges(nrThreads), grain(grain), function(function) {}
+
+            std::vector<WorkRange> ranges;
+            size_t grain;
+            std::function<void(size_t, size_t)> function;
+            /**
+             * The first exception thrown by function, set under
+             * errorMutex, failed skips the chunks left once set.
+             */
+            std::mutex errorMutex;
+            std::exception_ptr error;
+            std::atomic<bool> failed = false;
+        };
+
+        /**
+         * Marks the thread as running a loop for its lifetime.
+         */
+        struct InsideLoopScope {
+            InsideLoopScope() {
+                InsideLoop() = true;
+            }
+
+            ~InsideLoopScope() {
+                InsideLoop() = false;
+            }
+
+            InsideLoopScope(const InsideLoopScope &) = delete;
+            InsideLoopScope &operator=(const InsideLoopScope &) = delete;
+        };
+
+        static size_t DefaultWorkers() {
+            auto threads = std::thread::hardware_concurrency();
+            return threads > 1 ? threads - 1 : 0;
+        }
+
+        static bool &InsideLoop() {
+            thread_local bool inside = false;
+            return inside;
+        }
+
+        /**
+         * Rounds the index down to a multiple of grain within
+         * [begin, end].
+         */
+        static size_t Boundary(size_t begin, size_t end, size_t index, size_t grain) {
+            return std::clamp(index / grain * grain, begin, end);
+        }
+
+        /**
+         * Sleeps until the generation moves, then takes part in the
+         * new loop. The next loop can not start before every worker
+         * is done with the current one, so no generation is missed.
+         */
+        void WorkerLoop(size_t index) {
+            size_t seen = 0;
+            for (;;) {
+                generation.wait(seen);
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                Work(*current, index);
+                if (--pending == 0) {
+                    pending.notify_one();
+                }
+            }
+        }
+
+        /**
+         * Runs chunks of the own range, then steals from the others
+         * until every range is empty. Exceptions are stored in the
+         * loop, after the first one the remaining chunks are only
+         * taken, so every range still drains.
+         */
+        static void Work(Loop &loop, size_t self) noexcept {
+            InsideLoopScope scope;
+            size_t first = 0;
+            size_t last = 0;
+            for (;;) {
+                if (TakeChunk(loop, self, first, last)) {
+                    if (loop.failed) {
+                        continue;
+                    }
+                    try {
+                        loop.function(first, last);
+                    } catch (...) {
+                        std::lock_guard lock(loop.errorMutex);
+                        if (!loop.error) {
+                            loop.error = std::current_exception();
+                        }
+                        loop.failed = true;
+                    }
+                } else if (!Steal(loop, self)) {
+                    break;
+                }
+            }
+        }
+
+        static bool TakeChunk(Loop &loop, size_t self, size_t &first, size_t &last) {
+            auto &range = loop.ranges[self];
+            std::lock_guard lock(range.mutex);
+            if (range.begin >= range.end) {
+                return false;
+            }
+            first = range.begin;
+            last = std::min(range.end, (first / loop.grain + 1) * loop.grain);
+            range.begin = last;
+            return true;
+        }
+
+        /**
+         * Moves the back half of the first non empty range of
+         * another thread into the own range, or all of it if it is
+         * too small to split at a multiple of grain.
+         */
+        static bool Steal(Loop &loop, size_t self) {
+            auto nrThreads = loop.ranges.size();
+            for (size_t offset = 1; offset < nrThreads; offset++) {
+                auto &victim = loop.ranges[(self + offset) % nrThreads];
+                size_t first;
+                size_t last;
+                {
+                    std::lock_guard lock(victim.mutex);
+                    if (victim.begin >= victim.end) {
+                        continue;
+                    }
+                    auto middle = Boundary(victim.begin, victim.end, victim.begin + (victim.end - victim.begin) / 2, loop.grain);
+                    first = middle;
+                    last = victim.end;
+                    victim.end = middle;
+                }
+                auto &own = loop.ranges[self];
+                std::lock_guard lock(own.mutex);
+                own.begin = first;
+                own.end = last;
+                return true;
+            }
+            return false;
+        }
+
+        std::vector<std::thread> workers;
+        std::mutex submitMutex;
+        std::atomic<Loop *> current = nullptr;
+        std::atomic<size_t> generation = 0;
+        std::atomic<size_t> pending = 0;
+        std::atomic<bool> stopping = false;
+    };
+}
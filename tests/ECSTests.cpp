@@ -3,8 +3,40 @@
 //
 
 #include <ecs-cpp/EcsCpp.h>
+#include <ecs-cpp/EcsArchetype.h>
+#include <ecs-cpp/Scheduler.h>
+#include <ecs-cpp/CommandBuffer.h>
 #include <gtest/gtest.h>
 #include <future>
+#include <atomic>
+#include <memory>
+
+struct SparseComponent {
+    int value = 0;
+    std::array<char, 200> payload{};
+};
+
+template<>
+struct ecs::StoragePolicy<SparseComponent> {
+    static constexpr ecs::StorageType value = ecs::StorageType::Sparse;
+};
+
+struct TagComponent {
+};
+
+template<>
+struct ecs::StoragePolicy<TagComponent> {
+    static constexpr ecs::StorageType value = ecs::StorageType::Tag;
+};
+
+struct SingletonComponent {
+    int value = 0;
+};
+
+template<>
+struct ecs::StoragePolicy<SingletonComponent> {
+    static constexpr ecs::StorageType value = ecs::StorageType::Singleton;
+};
 
 TEST(ECS, GetLastSlot) {
     ecs::ECSManager<int, std::string> ecs;
@@ -181,119 +213,1339 @@ TEST(ECS, CheckLastSlot) {
     ASSERT_EQ(fakeEntity.GetId(), 1);
     EXPECT_THROW(auto ret = ecs.HasEntity(fakeEntity), std::out_of_range);
 
-    auto fakeEntity2 = ecs::EntityID(-1);
-    ASSERT_EQ(fakeEntity2.GetId(), -1);
-    EXPECT_THROW(auto ret = ecs.HasEntity(fakeEntity2), std::logic_error);
-}
+    auto fakeEntity2 = ecs::EntityID(-1);
+    ASSERT_EQ(fakeEntity2.GetId(), -1);
+    EXPECT_THROW(auto ret = ecs.HasEntity(fakeEntity2), std::logic_error);
+}
+
+TEST(ECS, RemoveEntity) {
+    ecs::ECSManager<int> ecs;
+
+    ecs::EntityID entity = ecs.AddEntity();
+    ASSERT_TRUE(ecs.HasEntity(entity));
+    ecs.RemoveEntity(entity);
+    ASSERT_FALSE(ecs.HasEntity(entity));
+}
+
+TEST(ECS, ReclaimId) {
+    ecs::ECSManager<int> ecs;
+
+    ecs::EntityID entity = ecs.AddEntity();
+    ASSERT_TRUE(ecs.HasEntity(entity));
+    ASSERT_EQ(entity.GetId(), 0);
+    ecs.RemoveEntity(entity);
+    ASSERT_FALSE(ecs.HasEntity(entity));
+
+    ecs::EntityID entity2 = ecs.AddEntity();
+    ASSERT_EQ(entity2.GetId(), 0);
+    ASSERT_TRUE(ecs.HasEntity(entity2));
+}
+
+TEST(ECS, StaleIdDoesNotAlias) {
+    ecs::ECSManager<int> ecs;
+
+    auto entity = ecs.BuildEntity(5);
+    ecs.RemoveEntity(entity);
+    auto entity2 = ecs.BuildEntity(42);
+
+    ASSERT_EQ(entity.GetId(), entity2.GetId());
+    ASSERT_NE(entity.GetGeneration(), entity2.GetGeneration());
+    ASSERT_FALSE(entity == entity2);
+
+    ASSERT_FALSE(ecs.HasEntity(entity));
+    ASSERT_TRUE(ecs.HasEntity(entity2));
+    ASSERT_FALSE(ecs.Has<int>(entity));
+    ASSERT_TRUE(ecs.Has<int>(entity2));
+    EXPECT_THROW(auto ret = ecs.Get<int>(entity), std::invalid_argument);
+    EXPECT_THROW(ecs.Add(entity, 1), std::invalid_argument);
+    EXPECT_THROW(ecs.Remove<int>(entity), std::invalid_argument);
+    EXPECT_THROW(ecs.RemoveEntity(entity), std::logic_error);
+
+    ASSERT_EQ(ecs.Get<int>(entity2), 42);
+    ASSERT_TRUE(ecs.HasEntity(entity2));
+}
+
+TEST(ECS, EntityIDPacking) {
+    constexpr ecs::EntityID id(7, 3);
+    static_assert(sizeof(ecs::EntityID) == sizeof(uint64_t));
+    static_assert(id.GetId() == 7);
+    static_assert(id.GetGeneration() == 3);
+    static_assert(id.NextGeneration().GetId() == 7);
+    static_assert(id.NextGeneration().GetGeneration() == 4);
+    static_assert(id.GetHandle() == ((uint64_t(3) << 32) | 7));
+    static_assert(not ecs::EntityID());
+    static_assert(ecs::EntityID(0));
+}
+
+TEST(ECS, RemoveCleanupComponents) {
+    ecs::ECSManager<int> ecs;
+
+    ASSERT_EQ(ecs.Size(), 0);
+    ecs::EntityID entity = ecs.AddEntity();
+    ASSERT_EQ(ecs.Size(), 1);
+    ASSERT_TRUE(ecs.HasEntity(entity));
+    ecs.Add(entity, 5);
+    ASSERT_TRUE(ecs.Has<int>(entity));
+    ecs.RemoveEntity(entity);
+    ASSERT_EQ(ecs.Size(), 0);
+    ASSERT_FALSE(ecs.HasEntity(entity));
+
+    ASSERT_THROW(ecs.RemoveEntity(entity), std::logic_error);
+    ASSERT_EQ(ecs.Size(), 0);
+
+    ecs::EntityID entity2 = ecs.AddEntity();
+    ASSERT_EQ(ecs.Size(), 1);
+    ASSERT_EQ(entity2.GetId(), 0);
+    ASSERT_TRUE(ecs.HasEntity(entity2));
+    ASSERT_FALSE(ecs.Has<int>(entity2));
+}
+
+TEST(ECS, RemoveComponent) {
+    ecs::ECSManager<int> ecs;
+
+    auto entity = ecs.AddEntity();
+    ecs.Add(entity, 5);
+    ASSERT_TRUE(ecs.HasEntity(entity));
+    ASSERT_TRUE(ecs.Has<int>(entity));
+    ecs.Remove<int>(entity);
+    ASSERT_TRUE(ecs.HasEntity(entity));
+    ASSERT_FALSE(ecs.Has<int>(entity));
+
+    ASSERT_THROW(ecs.Remove<int>(entity), std::logic_error);
+}
+
+TEST(ECS, LoopEntities) {
+    ecs::ECSManager<int, std::string> ecs;
+    {
+        int callCount = 0;
+        for (auto &entity: ecs) {
+            callCount++;
+        }
+        ASSERT_EQ(callCount, 0);
+    }
+
+    {
+        auto entity = ecs.AddEntity();
+        ecs.Add(entity, 5);
+        int callCount = 0;
+        for (auto &id: ecs) {
+            callCount++;
+            EXPECT_EQ(id, entity);
+            EXPECT_FALSE(ecs.Has<std::string>(id));
+            EXPECT_TRUE(ecs.Has<int>(id));
+        }
+        ASSERT_EQ(callCount, 1);
+    }
+    {
+        auto entity = ecs.AddEntity();
+        ecs.Add(entity, 2);
+        ecs.Add(entity, std::string("hej"));
+
+        int callCount = 0;
+        for (auto &id: ecs) {
+            callCount++;
+            if (id == entity) {
+                auto result = ecs.Has<int, std::string>(id);
+                EXPECT_TRUE(result);
+            }
+        }
+        ASSERT_EQ(callCount, 2);
+        ecs.RemoveEntity(entity);
+        callCount = 0;
+        for (auto &e: ecs) {
+            callCount++;
+        }
+        ASSERT_EQ(callCount, 1);
+        ASSERT_FALSE(ecs.HasEntity(entity));
+    }
+}
+
+TEST(ECS, Signature) {
+    ecs::Signature<70> signature;
+    EXPECT_EQ(signature.Words().size(), 2);
+    signature.Set(3);
+    signature.Set(65);
+    EXPECT_TRUE(signature.Test(3));
+    EXPECT_TRUE(signature.Test(65));
+    EXPECT_FALSE(signature.Test(64));
+
+    ecs::Signature<70> mask;
+    mask.Set(65);
+    EXPECT_TRUE(signature.Contains(mask));
+    mask.Set(4);
+    EXPECT_FALSE(signature.Contains(mask));
+
+    signature.Reset(3);
+    EXPECT_FALSE(signature.Test(3));
+    signature.Clear();
+    EXPECT_EQ(signature, ecs::Signature<70>());
+}
+
+TEST(ECS, MatchSignatures) {
+    std::vector<ecs::Signature<3>> signatures(64);
+    ecs::Signature<3> mask;
+    mask.Set(0);
+    mask.Set(2);
+    uint64_t expected = 0;
+    for (size_t i = 0; i < signatures.size(); i++) {
+        if (i % 3 == 0) {
+            signatures[i].Set(0);
+        }
+        if (i % 2 == 0) {
+            signatures[i].Set(2);
+        }
+        if (i % 3 == 0 && i % 2 == 0) {
+            expected |= uint64_t(1) << i;
+        }
+    }
+    EXPECT_EQ(ecs::MatchSignatures(signatures.data(), 64, mask), expected);
+    EXPECT_EQ(ecs::MatchSignatures(signatures.data(), 7, mask), expected & 0x7F);
+    EXPECT_EQ(ecs::MatchSignatures(signatures.data() + 1, 6, mask), 0b100000);
+
+    std::vector<ecs::Signature<100>> wide(10);
+    ecs::Signature<100> wideMask;
+    wideMask.Set(99);
+    wide[4].Set(99);
+    wide[9].Set(99);
+    EXPECT_EQ(ecs::MatchSignatures(wide.data(), 10, wideMask), (uint64_t(1) << 4) | (uint64_t(1) << 9));
+}
+
+TEST(ECS, SystemAcrossMatchBlocks) {
+    ecs::ECSManager<int, float> ecs;
+    std::vector<int> expected;
+    for (int i = 0; i < 300; i++) {
+        auto entity = ecs.AddEntity();
+        ecs.Add(entity, 1.0f);
+        if (i % 7 == 0 || (i >= 128 && i < 140)) {
+            ecs.Add(entity, i);
+            expected.push_back(i);
+        }
+    }
+    std::vector<int> visited;
+    for (auto [i, f]: ecs.GetSystem<int, float>()) {
+        visited.push_back(i);
+    }
+    EXPECT_EQ(visited, expected);
+
+    std::vector<int> parts;
+    for (size_t part = 0; part < 3; part++) {
+        for (auto [i]: ecs.GetSystemPart<int>(part, 3)) {
+            parts.push_back(i);
+        }
+    }
+    EXPECT_EQ(parts, expected);
+}
+
+TEST(ECS, OccupancyBitmap) {
+    ecs::OccupancyBitmap bitmap;
+    bitmap.Resize(10000);
+    bitmap.Set(5);
+    bitmap.Set(4100);
+    EXPECT_TRUE(bitmap.Test(5));
+    EXPECT_FALSE(bitmap.Test(6));
+    EXPECT_EQ(bitmap.Word(0), uint64_t(1) << 5);
+    EXPECT_EQ(bitmap.SummaryWord(0), 1);
+    EXPECT_EQ(bitmap.SummaryWord(1), 1);
+
+    bitmap.Set(6);
+    bitmap.Reset(5);
+    EXPECT_EQ(bitmap.SummaryWord(0), 1);
+    bitmap.Reset(6);
+    EXPECT_EQ(bitmap.SummaryWord(0), 0);
+    bitmap.Reset(4100);
+    EXPECT_EQ(bitmap.SummaryWord(1), 0);
+}
+
+TEST(ECS, OccupancyBitmapFind) {
+    ecs::OccupancyBitmap bitmap;
+    bitmap.Resize(10000);
+    EXPECT_EQ(bitmap.FindNext(0), SIZE_MAX);
+    EXPECT_EQ(bitmap.FindPrevious(9999), SIZE_MAX);
+    bitmap.Set(10);
+    bitmap.Set(130);
+    bitmap.Set(8200);
+    EXPECT_EQ(bitmap.FindNext(0), 10);
+    EXPECT_EQ(bitmap.FindNext(10), 10);
+    EXPECT_EQ(bitmap.FindNext(11), 130);
+    EXPECT_EQ(bitmap.FindNext(131), 8200);
+    EXPECT_EQ(bitmap.FindNext(8201), SIZE_MAX);
+    EXPECT_EQ(bitmap.FindPrevious(9999), 8200);
+    EXPECT_EQ(bitmap.FindPrevious(8199), 130);
+    EXPECT_EQ(bitmap.FindPrevious(130), 130);
+    EXPECT_EQ(bitmap.FindPrevious(63), 10);
+    EXPECT_EQ(bitmap.FindPrevious(9), SIZE_MAX);
+}
+
+TEST(ECS, ComponentRangeShrinksOnRemove) {
+    ecs::ECSManager<int, float> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 1000; i++) {
+        ids.push_back(ecs.AddEntity());
+        ecs.Add(ids.back(), i);
+    }
+    ecs.Add(ids[999], 1.0f);
+    ecs.Add(ids[0], 1.0f);
+    ecs.Add(ids[500], 1.0f);
+
+    for (int i = 0; i < 1000; i++) {
+        if (i != 500) {
+            ecs.RemoveEntity(ids[i]);
+        }
+    }
+    int count = 0;
+    for (auto [i, f]: ecs.GetSystem<int, float>()) {
+        EXPECT_EQ(i, 500);
+        count++;
+    }
+    EXPECT_EQ(count, 1);
+
+    ecs.Remove<float>(ids[500]);
+    auto system = ecs.GetSystem<float>();
+    EXPECT_TRUE(system.begin() == system.end());
+
+    auto entity = ecs.AddEntity();
+    ecs.Add(entity, 2.0f);
+    count = 0;
+    for (auto [f]: ecs.GetSystem<float>()) {
+        count++;
+    }
+    EXPECT_EQ(count, 1);
+}
+
+TEST(ECS, DisjointComponentRangesGiveEmptySystem) {
+    ecs::ECSManager<int, float> ecs;
+    for (int i = 0; i < 4; i++) {
+        ecs.Add(ecs.AddEntity(), i);
+    }
+    for (int i = 0; i < 4; i++) {
+        ecs.Add(ecs.AddEntity(), 1.0f);
+    }
+    auto system = ecs.GetSystem<int, float>();
+    EXPECT_TRUE(system.begin() == system.end());
+
+    ecs::ECSManager<int, float> empty;
+    empty.Add(empty.AddEntity(), 1);
+    auto emptySystem = empty.GetSystem<int, float>();
+    EXPECT_TRUE(emptySystem.begin() == emptySystem.end());
+}
+
+TEST(ECS, SparseQueryOverLargeWorld) {
+    ecs::ECSManager<int, float> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 20000; i++) {
+        ids.push_back(ecs.AddEntity());
+        ecs.Add(ids.back(), 1.0f);
+    }
+    ecs.Add(ids[0], 0);
+    std::vector<int> expected = {3, 4095, 4096, 9000, 19999};
+    for (auto i: expected) {
+        ecs.Add(ids[i], i);
+    }
+    ecs.Remove<int>(ids[0]);
+
+    std::vector<int> visited;
+    for (auto [i, f]: ecs.GetSystem<int, float>()) {
+        visited.push_back(i);
+    }
+    EXPECT_EQ(visited, expected);
+
+    ecs.RemoveEntity(ids[4096]);
+    visited.clear();
+    for (auto [i]: ecs.GetSystem<int>()) {
+        visited.push_back(i);
+    }
+    EXPECT_EQ(visited, std::vector<int>({3, 4095, 9000, 19999}));
+}
+
+TEST(ECS, SystemIteratorReferencesStorage) {
+    ecs::ECSManager<int, SparseComponent, TagComponent> ecs;
+    for (int i = 0; i < 10; i++) {
+        auto entity = ecs.AddEntity();
+        ecs.Add(entity, i);
+        if (i % 2) {
+            ecs.Add(entity, SparseComponent{i});
+            ecs.Add(entity, TagComponent{});
+        }
+    }
+    for (auto [i, sparse, tag]: ecs.GetSystem<int, SparseComponent, TagComponent>()) {
+        sparse.value += 100;
+        i = -i;
+    }
+    for (auto &id: ecs) {
+        auto value = ecs.Get<int>(id);
+        if (ecs.Has<SparseComponent>(id)) {
+            EXPECT_LT(value, 0);
+            EXPECT_EQ(ecs.Get<SparseComponent>(id).value, 100 - value);
+        } else {
+            EXPECT_GE(value, 0);
+        }
+    }
+}
+
+TEST(ECS, ForEach) {
+    ecs::ECSManager<int, float, SparseComponent> ecs;
+    std::vector<int> expected;
+    for (int i = 0; i < 500; i++) {
+        auto entity = ecs.AddEntity();
+        ecs.Add(entity, i);
+        if (i % 5 != 0 && !(i > 100 && i < 200)) {
+            ecs.Add(entity, 1.0f);
+            expected.push_back(i);
+        }
+        if (i % 50 == 1) {
+            ecs.Add(entity, SparseComponent{i});
+        }
+    }
+
+    std::vector<int> visited;
+    ecs.ForEach<int, float>([&](int &i, float &f) {
+        visited.push_back(i);
+        f = 2.0f;
+    });
+    EXPECT_EQ(visited, expected);
+    for (auto [i, f]: ecs.GetSystem<int, float>()) {
+        EXPECT_EQ(f, 2.0f);
+    }
+
+    int count = 0;
+    ecs.ForEach<SparseComponent, int>([&](ecs::EntityID id, SparseComponent &sparse, int &i) {
+        EXPECT_EQ(sparse.value, i);
+        EXPECT_EQ(ecs.Get<int>(id), i);
+        count++;
+    });
+    EXPECT_EQ(count, 10);
+}
+
+TEST(ECS, ForEachSystemPart) {
+    ecs::ECSManager<int> ecs;
+    for (int i = 0; i < 1000; i++) {
+        ecs.Add(ecs.AddEntity(), i);
+    }
+    std::vector<int> visited;
+    for (size_t part = 0; part < 3; part++) {
+        ecs.GetSystemPart<int>(part, 3).ForEach([&](int i) {
+            visited.push_back(i);
+        });
+    }
+    ASSERT_EQ(visited.size(), 1000);
+    for (int i = 0; i < 1000; i++) {
+        EXPECT_EQ(visited[i], i);
+    }
+
+    ecs::ECSManager<int, float> empty;
+    empty.Add(empty.AddEntity(), 1);
+    empty.ForEach<int, float>([](int &, float &) {
+        FAIL();
+    });
+}
+
+TEST(ECS, ForEachChunk) {
+    ecs::ECSManager<int, float> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 300; i++) {
+        ids.push_back(ecs.AddEntity());
+        ecs.Add(ids.back(), i);
+        if (i < 10 || (i >= 50 && i < 250)) {
+            ecs.Add(ids.back(), 1.0f);
+        }
+    }
+
+    std::vector<size_t> chunkSizes;
+    ecs.ForEachChunk<int, float>([&](std::span<int> ints, std::span<float> floats, std::span<const ecs::EntityID> entities) {
+        ASSERT_EQ(ints.size(), floats.size());
+        ASSERT_EQ(ints.size(), entities.size());
+        for (size_t i = 0; i < ints.size(); i++) {
+            EXPECT_EQ(entities[i], ids[ints[i]]);
+            floats[i] = static_cast<float>(ints[i]);
+        }
+        chunkSizes.push_back(ints.size());
+    });
+    EXPECT_EQ(chunkSizes, std::vector<size_t>({10, 200}));
+    for (auto [i, f]: ecs.GetSystem<int, float>()) {
+        EXPECT_EQ(f, static_cast<float>(i));
+    }
+
+    ecs.RemoveEntity(ids[100]);
+    chunkSizes.clear();
+    ecs.ForEachChunk<int, float>([&](std::span<int> ints, std::span<float>, std::span<const ecs::EntityID>) {
+        chunkSizes.push_back(ints.size());
+    });
+    EXPECT_EQ(chunkSizes, std::vector<size_t>({10, 50, 149}));
+}
+
+TEST(ECS, SystemWithout) {
+    struct Frozen {};
+    ecs::ECSManager<int, float, Frozen> ecs;
+    std::vector<int> expected;
+    for (int i = 0; i < 200; i++) {
+        auto entity = ecs.AddEntity();
+        ecs.Add(entity, i);
+        ecs.Add(entity, 1.0f);
+        if (i % 3 == 0) {
+            ecs.Add(entity, Frozen{});
+        } else {
+            expected.push_back(i);
+        }
+    }
+    std::vector<int> visited;
+    for (auto [i, f]: ecs.GetSystem<int, float, ecs::Without<Frozen>>()) {
+        visited.push_back(i);
+    }
+    EXPECT_EQ(visited, expected);
+
+    visited.clear();
+    ecs.ForEach<int, ecs::Without<Frozen>>([&](int &i) {
+        visited.push_back(i);
+    });
+    EXPECT_EQ(visited, expected);
+
+    int count = 0;
+    for (auto [i]: ecs.GetSystem<ecs::Without<Frozen, float>, int>()) {
+        count++;
+    }
+    EXPECT_EQ(count, 0);
+
+    auto extra = ecs.AddEntity();
+    EXPECT_TRUE(ecs.HasEntity(extra));
+    count = 0;
+    ecs.ForEach<ecs::Without<Frozen>>([&](ecs::EntityID id) {
+        EXPECT_FALSE(ecs.Has<Frozen>(id));
+        count++;
+    });
+    EXPECT_EQ(count, expected.size() + 1);
+}
+
+TEST(ECS, SystemWith) {
+    ecs::ECSManager<int, float, TagComponent> ecs;
+    for (int i = 0; i < 10; i++) {
+        auto entity = ecs.BuildEntity(i, 1.0f);
+        if (i % 2) {
+            ecs.Add(entity, TagComponent{});
+        }
+    }
+    int count = 0;
+    for (auto [i]: ecs.GetSystem<int, ecs::With<TagComponent, float>>()) {
+        EXPECT_EQ(i % 2, 1);
+        count++;
+    }
+    EXPECT_EQ(count, 5);
+
+    count = 0;
+    ecs.ForEachChunk<int, ecs::Without<TagComponent>>([&](std::span<int> ints, std::span<const ecs::EntityID>) {
+        for (auto i: ints) {
+            EXPECT_EQ(i % 2, 0);
+            count++;
+        }
+    });
+    EXPECT_EQ(count, 5);
+
+    count = 0;
+    for (auto [f]: ecs.GetSystem<ecs::Without<TagComponent>, float>()) {
+        count++;
+    }
+    EXPECT_EQ(count, 5);
+}
+
+TEST(ECS, SystemMaybe) {
+    ecs::ECSManager<int, float, SparseComponent> ecs;
+    for (int i = 0; i < 100; i++) {
+        auto entity = ecs.BuildEntity(i);
+        if (i % 4 == 0) {
+            ecs.Add(entity, static_cast<float>(i));
+        }
+        if (i % 10 == 0) {
+            ecs.Add(entity, SparseComponent{i});
+        }
+    }
+
+    int count = 0;
+    int withFloat = 0;
+    for (auto [i, f, sparse]: ecs.GetSystem<int, ecs::Maybe<float>, ecs::Maybe<SparseComponent>>()) {
+        count++;
+        EXPECT_EQ(f != nullptr, i % 4 == 0);
+        EXPECT_EQ(sparse != nullptr, i % 10 == 0);
+        if (f) {
+            EXPECT_EQ(*f, static_cast<float>(i));
+            *f = -1.0f;
+            withFloat++;
+        }
+        if (sparse) {
+            EXPECT_EQ(sparse->value, i);
+        }
+    }
+    EXPECT_EQ(count, 100);
+    EXPECT_EQ(withFloat, 25);
+    for (auto [f]: ecs.GetSystem<float>()) {
+        EXPECT_EQ(f, -1.0f);
+    }
+
+    count = 0;
+    ecs.ForEach<SparseComponent, ecs::Maybe<float>>([&](SparseComponent &sparse, float *f) {
+        EXPECT_EQ(f != nullptr, sparse.value % 4 == 0);
+        count++;
+    });
+    EXPECT_EQ(count, 10);
+}
+
+TEST(ECS, ConstQuery) {
+    ecs::ECSManager<int, float, SparseComponent> ecs;
+    for (int i = 0; i < 10; i++) {
+        auto entity = ecs.BuildEntity(i, static_cast<float>(i));
+        if (i % 2) {
+            ecs.Add(entity, SparseComponent{i});
+        }
+    }
+    for (auto [i, f]: ecs.GetSystem<const int, float>()) {
+        static_assert(std::is_same_v<decltype(i), const int &>);
+        static_assert(std::is_same_v<decltype(f), float &>);
+        f += 1.0f;
+    }
+    for (auto [i, sparse]: ecs.GetSystem<int, ecs::Maybe<const SparseComponent>>()) {
+        static_assert(std::is_same_v<decltype(sparse), const SparseComponent *>);
+        EXPECT_EQ(sparse != nullptr, i % 2 == 1);
+    }
+
+    const auto &view = ecs;
+    float sum = 0;
+    for (auto [i, f]: view.GetSystem<const int, const float>()) {
+        static_assert(std::is_same_v<decltype(f), const float &>);
+        EXPECT_EQ(f, static_cast<float>(i) + 1.0f);
+        sum += f;
+    }
+    EXPECT_EQ(sum, 55.0f);
+
+    int count = 0;
+    view.ForEach<const SparseComponent, const int>([&](const SparseComponent &sparse, const int &i) {
+        EXPECT_EQ(sparse.value, i);
+        count++;
+    });
+    EXPECT_EQ(count, 5);
+
+    count = 0;
+    view.ForEachChunk<const int, ecs::With<SparseComponent>>([&](std::span<const int> ints, std::span<const ecs::EntityID> ids) {
+        count += static_cast<int>(ints.size());
+    });
+    EXPECT_EQ(count, 5);
+
+    auto id = *ecs.begin();
+    EXPECT_EQ(view.Get<int>(id), 0);
+    auto [i, f] = view.GetSeveral<int, float>(id);
+    EXPECT_EQ(f, 1.0f);
+    EXPECT_THROW(auto &sparse = view.Get<SparseComponent>(id), std::invalid_argument);
+}
+
+TEST(ECS, EntityQueryTerm) {
+    ecs::ECSManager<int, float> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 100; i++) {
+        ids.push_back(ecs.BuildEntity(i));
+        if (i % 3 == 0) {
+            ecs.Add(ids.back(), 1.0f);
+        }
+    }
+    ecs.RemoveEntity(ids[3]);
+    ids[3] = ecs.BuildEntity(3, 1.0f);
+
+    int count = 0;
+    for (auto [id, i, f]: ecs.GetSystem<ecs::Entity, const int, float>()) {
+        static_assert(std::is_same_v<decltype(id), ecs::EntityID>);
+        EXPECT_EQ(id, ids[i]);
+        count++;
+    }
+    EXPECT_EQ(count, 34);
+
+    auto system = ecs.GetSystem<int, ecs::Without<float>>();
+    for (auto it = system.begin(); it != system.end(); ++it) {
+        auto [i] = *it;
+        EXPECT_EQ(it.GetEntityID(), ids[i]);
+    }
+
+    const auto &view = ecs;
+    count = 0;
+    view.ForEach<ecs::Entity, ecs::With<float>>([&](ecs::EntityID id) {
+        EXPECT_TRUE(view.Has<float>(id));
+        count++;
+    });
+    EXPECT_EQ(count, 34);
+}
+
+TEST(ECS, CachedQuery) {
+    ecs::ECSManager<int, float, SparseComponent> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 10; i++) {
+        ids.push_back(ecs.BuildEntity(i));
+    }
+    auto query = ecs.GetQuery<int, float>();
+    EXPECT_EQ(query.Size(), 0);
+
+    ecs.Add(ids[2], 2.0f);
+    ecs.Add(ids[5], 5.0f);
+    ecs.Add(ids[7], 7.0f);
+    EXPECT_EQ(query.Size(), 3);
+    auto sum = [&] {
+        int total = 0;
+        for (auto [i, f]: query) {
+            EXPECT_EQ(static_cast<float>(i), f);
+            total += i;
+        }
+        return total;
+    };
+    EXPECT_EQ(sum(), 14);
+
+    ecs.Remove<float>(ids[5]);
+    EXPECT_EQ(sum(), 9);
+    ecs.RemoveEntity(ids[2]);
+    EXPECT_EQ(sum(), 7);
+    EXPECT_EQ(query.Size(), 1);
+
+    auto entity = ecs.BuildEntity(20, 20.0f);
+    EXPECT_EQ(sum(), 27);
+
+    auto same = ecs.GetQuery<int, float>();
+    EXPECT_EQ(same.Size(), 2);
+    int count = 0;
+    same.ForEach([&](ecs::EntityID id, int &i, float &f) {
+        EXPECT_TRUE(id == entity || id == ids[7]);
+        count++;
+    });
+    EXPECT_EQ(count, 2);
+}
+
+TEST(ECS, CachedQueryWithTerms) {
+    ecs::ECSManager<int, float, TagComponent> ecs;
+    auto query = ecs.GetQuery<ecs::Entity, const int, ecs::Without<TagComponent>>();
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 100; i++) {
+        ids.push_back(ecs.BuildEntity(i));
+        if (i % 2) {
+            ecs.Add(ids.back(), TagComponent{});
+        }
+    }
+    EXPECT_EQ(query.Size(), 50);
+
+    std::vector<int> visited;
+    for (size_t part = 0; part < 4; part++) {
+        for (auto [id, i]: query.GetSystemPart(part, 4)) {
+            EXPECT_EQ(id, ids[i]);
+            visited.push_back(i);
+        }
+    }
+    std::sort(visited.begin(), visited.end());
+    ASSERT_EQ(visited.size(), 50);
+    for (int i = 0; i < 50; i++) {
+        EXPECT_EQ(visited[i], i * 2);
+    }
+
+    auto unmarked = ecs.GetQuery<ecs::Entity, ecs::Without<TagComponent>>();
+    auto empty = ecs.AddEntity();
+    EXPECT_EQ(unmarked.Size(), 51);
+    EXPECT_EQ(query.Size(), 50);
+    ecs.Add(empty, TagComponent{});
+    EXPECT_EQ(unmarked.Size(), 50);
+}
+
+TEST(ECS, ChangedFilter) {
+    ecs::ECSManager<int, float> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 200; i++) {
+        ids.push_back(ecs.BuildEntity(i, float(i)));
+    }
+    auto since = ecs.GetTick();
+    ecs.AdvanceTick();
+
+    auto changed = [&] {
+        std::vector<int> result;
+        for (auto [i]: ecs.GetSystem<const int, ecs::Changed<float>>().Since(since)) {
+            result.push_back(i);
+        }
+        return result;
+    };
+    EXPECT_TRUE(changed().empty());
+    auto all = 0;
+    for ([[maybe_unused]] auto _: ecs.GetSystem<ecs::Changed<float>>()) {
+        all++;
+    }
+    EXPECT_EQ(all, 200);
+
+    ecs.Get<float>(ids[3]) = 1.0f;
+    ecs.Get<float>(ids[150]) = 2.0f;
+    EXPECT_EQ(changed(), (std::vector<int>{3, 150}));
+
+    for (auto [i, f]: ecs.GetSystem<const int, const float>()) {
+        EXPECT_GE(f, 0.0f);
+    }
+    EXPECT_EQ(changed().size(), 2);
+    auto seen = 0;
+    ecs.ForEach<const int, float, ecs::Changed<float>>([&](const int &, float &) { seen++; });
+    EXPECT_EQ(seen, 200);
+
+    since = ecs.GetTick();
+    ecs.AdvanceTick();
+    EXPECT_TRUE(changed().empty());
+    ecs.ForEachChunk<float>([&](std::span<float> fs, std::span<const ecs::EntityID>) {
+        EXPECT_FALSE(fs.empty());
+    });
+    EXPECT_EQ(changed().size(), 200);
+}
+
+TEST(ECS, ChangedFilterLateWrite) {
+    ecs::ECSManager<int, float> ecs;
+    auto early = ecs.BuildEntity(1, 1.0f);
+    auto late = ecs.BuildEntity(2, 2.0f);
+    ecs::Tick lastRun = ecs.GetTick();
+    ecs.AdvanceTick();
+    auto run = [&] {
+        std::vector<int> result;
+        auto thisRun = ecs.GetTick();
+        for (auto [i]: ecs.GetSystem<const int, ecs::Changed<float>>().Since(lastRun)) {
+            result.push_back(i);
+        }
+        ecs.AdvanceTick();
+        lastRun = thisRun;
+        return result;
+    };
+
+    ecs.Get<float>(early) = 3.0f;
+    EXPECT_EQ(run(), std::vector<int>{1});
+    ecs.Get<float>(late) = 4.0f;
+    EXPECT_EQ(run(), std::vector<int>{2});
+    EXPECT_TRUE(run().empty());
+}
+
+TEST(ECS, ChangedFilterQuietsDown) {
+    ecs::ECSManager<int> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 10; i++) {
+        ids.push_back(ecs.BuildEntity(i));
+    }
+    ecs::Tick lastRun = ecs.GetTick();
+    ecs.AdvanceTick();
+    auto run = [&] {
+        size_t matches = 0;
+        auto thisRun = ecs.GetTick();
+        for (auto [i]: ecs.GetSystem<int, ecs::Changed<int>>().Since(lastRun)) {
+            i += 0;
+            matches++;
+        }
+        ecs.AdvanceTick();
+        lastRun = thisRun;
+        return matches;
+    };
+
+    ecs.Get<int>(ids[3]) = 30;
+    EXPECT_EQ(run(), 1);
+    for (int frame = 0; frame < 4; frame++) {
+        EXPECT_EQ(run(), 0);
+    }
+    ecs.Get<int>(ids[5]) = 50;
+    EXPECT_EQ(run(), 1);
+    EXPECT_EQ(run(), 0);
+}
+
+TEST(ECS, ChangedFilterStorages) {
+    ecs::ECSManager<int, SparseComponent, SingletonComponent, TagComponent> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 100; i++) {
+        ids.push_back(ecs.BuildEntity(i, TagComponent{}));
+        if (i % 3 == 0) {
+            ecs.Add(ids.back(), SparseComponent{i});
+        }
+    }
+    ecs.Add(ids[50], SingletonComponent{});
+    auto since = ecs.GetTick();
+    ecs.AdvanceTick();
+
+    ecs.Get<SparseComponent>(ids[3]).value = 1;
+    ecs.Get<SparseComponent>(ids[90]).value = 2;
+    ecs.RemoveEntity(ids[0]);
+    ecs.Add(ids[1], SparseComponent{1});
+    std::vector<int> changed;
+    for (auto [i]: ecs.GetSystem<const int, ecs::Changed<SparseComponent>, ecs::With<TagComponent>>().Since(since)) {
+        changed.push_back(i);
+    }
+    std::sort(changed.begin(), changed.end());
+    EXPECT_EQ(changed, (std::vector<int>{1, 3, 90}));
+
+    std::vector<int> added;
+    for (auto [i]: ecs.GetSystem<const int, ecs::Added<SparseComponent>>().Since(since)) {
+        added.push_back(i);
+    }
+    EXPECT_EQ(added, std::vector<int>{1});
+
+    auto singletonChanged = [&] {
+        int count = 0;
+        for ([[maybe_unused]] auto _: ecs.GetSystem<ecs::Changed<SingletonComponent>>().Since(since)) {
+            count++;
+        }
+        return count;
+    };
+    EXPECT_EQ(singletonChanged(), 0);
+    ecs.GetSingleton<SingletonComponent>().value = 1;
+    EXPECT_EQ(singletonChanged(), 1);
+}
+
+TEST(ECS, AddedFilter) {
+    ecs::ECSManager<int, float> ecs;
+    for (int i = 0; i < 100; i++) {
+        ecs.BuildEntity(i);
+    }
+    auto since = ecs.GetTick();
+    ecs.AdvanceTick();
+    auto late = ecs.BuildEntity(100, 1.0f);
+    auto tagged = ecs.AddEntity();
+    ecs.Add(tagged, 101);
+
+    std::vector<int> added;
+    for (auto [i]: ecs.GetSystem<int, ecs::Added<int>>().Since(since)) {
+        added.push_back(i);
+    }
+    EXPECT_EQ(added, (std::vector<int>{100, 101}));
+
+    auto query = ecs.GetQuery<ecs::Entity, ecs::Added<float>>();
+    std::vector<ecs::EntityID> lateIds;
+    for (auto [id]: query.GetSystem().Since(since)) {
+        lateIds.push_back(id);
+    }
+    EXPECT_EQ(lateIds, std::vector<ecs::EntityID>{late});
+    EXPECT_EQ(ecs.GetTick(), since + 1);
+}
+
+TEST(ECS, BalancedSystemPart) {
+    ecs::ECSManager<int, float> ecs;
+    for (int i = 0; i < 1000; i++) {
+        auto id = ecs.BuildEntity(i);
+        if (i < 100 || i % 97 == 0) {
+            ecs.Add(id, float(i));
+        }
+    }
+    size_t total = 0;
+    ecs.ForEach<int, float>([&](int &, float &) { total++; });
+
+    for (size_t parts: {1, 3, 4, 7, 200}) {
+        std::vector<int> visited;
+        for (size_t part = 0; part < parts; part++) {
+            size_t size = 0;
+            for (auto [i, f]: ecs.GetSystemPart<const int, const float>(part, parts, ecs::Partition::Balanced)) {
+                visited.push_back(i);
+                size++;
+            }
+            EXPECT_GE(size, total / parts);
+            EXPECT_LE(size, total / parts + 1);
+        }
+        std::sort(visited.begin(), visited.end());
+        EXPECT_EQ(visited.size(), total);
+        EXPECT_TRUE(std::adjacent_find(visited.begin(), visited.end()) == visited.end());
+    }
+
+    auto query = ecs.GetQuery<const int, ecs::With<float>>();
+    size_t visited = 0;
+    for (size_t part = 0; part < 4; part++) {
+        size_t size = 0;
+        query.GetSystemPart(part, 4, ecs::Partition::Balanced).ForEach([&](const int &) { size++; });
+        EXPECT_GE(size, total / 4);
+        EXPECT_LE(size, total / 4 + 1);
+        visited += size;
+    }
+    EXPECT_EQ(visited, total);
+}
+
+TEST(ECS, SystemParts) {
+    ecs::ECSManager<int, float> ecs;
+    for (int i = 0; i < 1000; i++) {
+        auto id = ecs.BuildEntity(i);
+        if (i < 100 || i % 97 == 0) {
+            ecs.Add(id, float(i));
+        }
+    }
+    auto query = ecs.GetQuery<const int, ecs::With<float>>();
+    for (auto partition: {ecs::Partition::Slots, ecs::Partition::Balanced, ecs::Partition::Aligned}) {
+        for (size_t parts: {1, 3, 7, 200}) {
+            auto systems = ecs.GetSystemParts<const int, const float>(parts, partition);
+            auto querySystems = query.GetSystemParts(parts, partition);
+            ASSERT_EQ(systems.size(), parts);
+            ASSERT_EQ(querySystems.size(), parts);
+            for (size_t part = 0; part < parts; part++) {
+                std::vector<int> expected;
+                std::vector<int> visited;
+                ecs.GetSystemPart<const int, const float>(part, parts, partition).ForEach([&](const int &i, const float &) { expected.push_back(i); });
+                systems[part].ForEach([&](const int &i, const float &) { visited.push_back(i); });
+                EXPECT_EQ(visited, expected);
+
+                expected.clear();
+                visited.clear();
+                query.GetSystemPart(part, parts, partition).ForEach([&](const int &i) { expected.push_back(i); });
+                querySystems[part].ForEach([&](const int &i) { visited.push_back(i); });
+                EXPECT_EQ(visited, expected);
+            }
+        }
+    }
+}
+
+struct alignas(128) OverAlignedComponent {
+    int value = 0;
+};
+
+TEST(ECS, OverAlignedComponent) {
+    ecs::ECSManager<int, OverAlignedComponent> ecs;
+    for (int i = 0; i < 100; i++) {
+        ecs.BuildEntity(i, OverAlignedComponent{i});
+    }
+    int sum = 0;
+    ecs.ForEach<const int, OverAlignedComponent>([&](const int &i, OverAlignedComponent &component) {
+        EXPECT_EQ(reinterpret_cast<uintptr_t>(&component) % alignof(OverAlignedComponent), 0);
+        EXPECT_EQ(component.value, i);
+        sum += component.value;
+    });
+    EXPECT_EQ(sum, 4950);
+}
+
+TEST(ECS, AlignedSystemPart) {
+    ecs::ECSManager<int, float> ecs;
+    for (int i = 0; i < 1000; i++) {
+        ecs.BuildEntity(i, float(i));
+    }
+    for (size_t parts: {1, 3, 7, 40}) {
+        std::vector<int> visited;
+        for (size_t part = 0; part < parts; part++) {
+            bool first = true;
+            for (auto [id, i, f]: ecs.GetSystemPart<ecs::Entity, int, float>(part, parts, ecs::Partition::Aligned)) {
+                if (first) {
+                    EXPECT_EQ(id.GetId() % 64, 0);
+                    EXPECT_EQ(reinterpret_cast<uintptr_t>(&f) % ecs::CacheLineSize, 0);
+                    EXPECT_EQ(reinterpret_cast<uintptr_t>(&i) % ecs::CacheLineSize, 0);
+                    first = false;
+                }
+                visited.push_back(i);
+            }
+        }
+        std::sort(visited.begin(), visited.end());
+        ASSERT_EQ(visited.size(), 1000);
+        for (int i = 0; i < 1000; i++) {
+            EXPECT_EQ(visited[i], i);
+        }
+    }
+}
+
+TEST(ECS, ThreadPoolParallelFor) {
+    ecs::ThreadPool pool(3);
+    EXPECT_EQ(pool.Size(), 4);
+    for (size_t end: {0, 1, 63, 64, 1000, 100000}) {
+        std::vector<std::atomic<int>> visits(end);
+        pool.ParallelFor(0, end, 64, [&](size_t first, size_t last) {
+            EXPECT_TRUE(first % 64 == 0);
+            EXPECT_TRUE(last % 64 == 0 || last == end);
+            for (auto i = first; i < last; i++) {
+                visits[i]++;
+            }
+        });
+        for (const auto &visit: visits) {
+            ASSERT_EQ(visit, 1);
+        }
+    }
+
+    std::atomic<size_t> inner = 0;
+    pool.ParallelFor(0, 1000, 10, [&](size_t first, size_t last) {
+        pool.ParallelFor(first, last, 1, [&](size_t innerFirst, size_t innerLast) {
+            inner += innerLast - innerFirst;
+        });
+    });
+    EXPECT_EQ(inner, 1000);
+}
+
+TEST(ECS, ThreadPoolParallelForThrows) {
+    ecs::ThreadPool pool(3);
+    for (size_t thrower: {0, 500, 999}) {
+        std::atomic<size_t> visited = 0;
+        EXPECT_THROW(pool.ParallelFor(0, 1000, 1, [&](size_t first, size_t last) {
+            if (first <= thrower && thrower < last) {
+                throw std::runtime_error("chunk failed");
+            }
+            visited += last - first;
+        }), std::runtime_error);
+        EXPECT_LT(visited, 1000);
+
+        std::vector<std::atomic<int>> visits(1000);
+        pool.ParallelFor(0, 1000, 1, [&](size_t first, size_t last) {
+            for (auto i = first; i < last; i++) {
+                visits[i]++;
+            }
+        });
+        for (const auto &visit: visits) {
+            ASSERT_EQ(visit, 1);
+        }
+    }
+
+    ecs::ECSManager<int> ecs;
+    for (int i = 0; i < 1000; i++) {
+        ecs.BuildEntity(i);
+    }
+    ecs::Scheduler scheduler(ecs, pool);
+    scheduler.Add<const int>([](const int &) {});
+    scheduler.Add<const int>([](const int &i) {
+        if (i == 10) {
+            throw std::runtime_error("system failed");
+        }
+    });
+    EXPECT_THROW(scheduler.Run(), std::runtime_error);
+}
+
+TEST(ECS, ParallelForEach) {
+    ecs::ECSManager<int, float, TagComponent> ecs;
+    std::vector<ecs::EntityID> ids;
+    for (int i = 0; i < 20000; i++) {
+        ids.push_back(ecs.BuildEntity(i));
+        if (i < 1000 || i % 7 == 0) {
+            ecs.Add(ids.back(), 1.0f);
+        }
+    }
+    ecs::ThreadPool pool(3);
+    std::atomic<int> count = 0;
+    ecs.ParallelForEach<const int, float>([&](ecs::EntityID id, const int &i, float &f) {
+        EXPECT_EQ(id, ids[i]);
+        f += float(i);
+        count++;
+    }, pool);
+    int expected = 0;
+    ecs.ForEach<const int, const float>([&](const int &, const float &) { expected++; });
+    EXPECT_EQ(count, expected);
+    for (auto [i, f]: ecs.GetSystem<const int, const float>()) {
+        ASSERT_FLOAT_EQ(f, 1.0f + float(i));
+    }
+
+    std::atomic<int> tagged = 0;
+    ecs.Add(ids[5], TagComponent{});
+    ecs.Add(ids[14000], TagComponent{});
+    std::as_const(ecs).ParallelForEach<const int, ecs::With<TagComponent>>([&](const int &) { tagged++; });
+    EXPECT_EQ(tagged, 2);
 
-TEST(ECS, RemoveEntity) {
-    ecs::ECSManager<int> ecs;
+    std::atomic<int> queried = 0;
+    ecs.GetQuery<int, ecs::Without<float>>().ParallelForEach([&](int &) { queried++; }, pool);
+    EXPECT_EQ(queried, 20000 - count);
+}
 
-    ecs::EntityID entity = ecs.AddEntity();
-    ASSERT_TRUE(ecs.HasEntity(entity));
-    ecs.RemoveEntity(entity);
-    ASSERT_FALSE(ecs.HasEntity(entity));
+TEST(ECS, SchedulerStages) {
+    ecs::ECSManager<int, float, std::string, TagComponent> ecs;
+    ecs::Scheduler scheduler(ecs);
+    scheduler.Add<int, const float>([](int &, const float &) {});
+    scheduler.Add<const float, std::string>([](const float &, std::string &) {});
+    scheduler.Add<const int>([](const int &) {});
+    scheduler.Add<ecs::Entity, const float, ecs::Without<TagComponent>>([](ecs::EntityID, const float &) {});
+    scheduler.Add<float>([](float &) {});
+    scheduler.Add<ecs::Maybe<const std::string>, const int>([](const std::string *, const int &) {});
+    EXPECT_EQ(scheduler.Size(), 6);
+    EXPECT_EQ(scheduler.GetStages(), (std::vector<std::vector<size_t>>{{0, 1, 3}, {2, 4, 5}}));
 }
 
-TEST(ECS, ReclaimId) {
-    ecs::ECSManager<int> ecs;
+TEST(ECS, SchedulerRun) {
+    ecs::ECSManager<int, float, std::string> ecs;
+    for (int i = 0; i < 1000; i++) {
+        ecs.BuildEntity(i, 1.0f);
+    }
+    ecs::ThreadPool pool(3);
+    ecs::Scheduler scheduler(ecs, pool);
+    std::atomic<int> reads = 0;
+    scheduler.Add<float>([](float &f) { f *= 2; });
+    scheduler.Add<const int>([&](const int &) { reads++; });
+    scheduler.Add<const int, float>([](auto &system) {
+        for (auto [i, f]: system) {
+            f += float(i);
+        }
+    });
+    scheduler.Add<const int, const float>([&](const int &i, const float &f) {
+        EXPECT_FLOAT_EQ(f, 2.0f + float(i));
+    });
+    EXPECT_EQ(scheduler.GetStages().size(), 3);
+    scheduler.Run();
+    EXPECT_EQ(reads, 1000);
+    for (auto [i, f]: ecs.GetSystem<const int, const float>()) {
+        ASSERT_FLOAT_EQ(f, 2.0f + float(i));
+    }
+}
 
-    ecs::EntityID entity = ecs.AddEntity();
-    ASSERT_TRUE(ecs.HasEntity(entity));
-    ASSERT_EQ(entity.GetId(), 0);
-    ecs.RemoveEntity(entity);
-    ASSERT_FALSE(ecs.HasEntity(entity));
+TEST(ECS, CommandBuffer) {
+    ecs::ECSManager<int, float, std::string, TagComponent> ecs;
+    for (int i = 0; i < 100; i++) {
+        ecs.BuildEntity(i, float(i));
+    }
+    ecs::CommandBuffer<decltype(ecs)> commands;
+    for (auto [id, i, f]: ecs.GetSystem<ecs::Entity, const int, const float>()) {
+        if (i % 2) {
+            commands.RemoveEntity(id);
+        } else if (i % 3 == 0) {
+            commands.Remove<float>(id);
+            commands.Add(id, TagComponent{});
+        } else {
+            commands.Add(id, std::to_string(i));
+            commands.Add(id, 2.0f);
+        }
+        if (i < 10) {
+            commands.BuildEntity(i + 1000, std::string("new"));
+        }
+    }
+    EXPECT_EQ(ecs.Size(), 100);
+    EXPECT_FALSE(commands.Empty());
 
-    ecs::EntityID entity2 = ecs.AddEntity();
-    ASSERT_EQ(entity2.GetId(), 0);
-    ASSERT_TRUE(ecs.HasEntity(entity2));
+    auto created = commands.Apply(ecs);
+    EXPECT_TRUE(commands.Empty());
+    EXPECT_EQ(ecs.Size(), 60);
+    ASSERT_EQ(created.size(), 10);
+    for (int i = 0; i < 10; i++) {
+        EXPECT_EQ(ecs.Get<int>(created[i]), i + 1000);
+        EXPECT_EQ(ecs.Get<std::string>(created[i]), "new");
+    }
+    for (auto [i]: ecs.GetSystem<const int, ecs::With<TagComponent>>()) {
+        EXPECT_EQ(i % 6, 0);
+    }
+    for (auto [i, f, str]: ecs.GetSystem<const int, const float, const std::string>()) {
+        EXPECT_NE(i % 3, 0);
+        EXPECT_FLOAT_EQ(f, 2.0f);
+        EXPECT_EQ(str, std::to_string(i));
+    }
 }
 
-TEST(ECS, RemoveCleanupComponents) {
-    ecs::ECSManager<int> ecs;
+TEST(ECS, CommandBufferSkipsRemovedEntities) {
+    ecs::ECSManager<int, float> ecs;
+    auto entity = ecs.BuildEntity(1);
+    ecs::CommandBuffer<decltype(ecs)> first;
+    ecs::CommandBuffer<decltype(ecs)> second;
+    first.RemoveEntity(entity);
+    second.Add(entity, 1.0f);
+    second.RemoveEntity(entity);
+    second.Remove<int>(entity);
+    first.Apply(ecs);
+    EXPECT_EQ(second.Size(), 3);
+    second.Apply(ecs);
+    EXPECT_EQ(ecs.Size(), 0);
+    EXPECT_FALSE(ecs.HasEntity(entity));
+}
 
-    ASSERT_EQ(ecs.Size(), 0);
-    ecs::EntityID entity = ecs.AddEntity();
-    ASSERT_EQ(ecs.Size(), 1);
-    ASSERT_TRUE(ecs.HasEntity(entity));
-    ecs.Add(entity, 5);
-    ASSERT_TRUE(ecs.Has<int>(entity));
-    ecs.RemoveEntity(entity);
-    ASSERT_EQ(ecs.Size(), 0);
-    ASSERT_FALSE(ecs.HasEntity(entity));
+TEST(ECS, CommandBufferMovesComponents) {
+    ecs::ECSManager<std::unique_ptr<int>, int> ecs;
+    ecs::CommandBuffer<decltype(ecs)> commands;
+    commands.BuildEntity(std::make_unique<int>(1), 1);
+    auto created = commands.Apply(ecs);
+    for (int i = 0; i < 100; i++) {
+        commands.BuildEntity(i);
+        commands.Add(created.front(), std::make_unique<int>(i));
+        commands.Apply(ecs);
+    }
+    EXPECT_EQ(ecs.Size(), 101);
+    EXPECT_EQ(*ecs.Get<std::unique_ptr<int>>(created.front()), 99);
+}
 
-    ASSERT_THROW(ecs.RemoveEntity(entity), std::logic_error);
-    ASSERT_EQ(ecs.Size(), 0);
+TEST(ECS, ConcurrentSpawn) {
+    ecs::ECSManager<int, float, ecs::EntityID> ecs;
+    for (int i = 0; i < 1000; i++) {
+        ecs.BuildEntity(i);
+    }
+    ecs::CommandBuffer<decltype(ecs)> buffers[4];
+    std::vector<std::future<void>> results;
+    for (int part = 0; part < 4; part++) {
+        results.push_back(std::async(std::launch::async, [&ecs, &buffers, part]() {
+            auto &buffer = buffers[part];
+            for (auto [i]: ecs.GetSystemPart<const int>(part, 4)) {
+                auto ids = ecs.ReserveEntities(2);
+                for (auto id: ids) {
+                    buffer.Add(id, float(i));
+                }
+                buffer.Add(ecs.ReserveEntity(), -i);
+            }
+        }));
+    }
+    for (const auto &future: results) {
+        future.wait();
+    }
+    EXPECT_EQ(ecs.Size(), 1000);
+    for (auto &buffer: buffers) {
+        buffer.Apply(ecs);
+    }
+    EXPECT_EQ(ecs.Size(), 4000);
 
-    ecs::EntityID entity2 = ecs.AddEntity();
-    ASSERT_EQ(ecs.Size(), 1);
-    ASSERT_EQ(entity2.GetId(), 0);
-    ASSERT_TRUE(ecs.HasEntity(entity2));
-    ASSERT_FALSE(ecs.Has<int>(entity2));
+    std::vector<int> spawned(1000);
+    for (auto [id, f]: ecs.GetSystem<const ecs::EntityID, const float>()) {
+        EXPECT_TRUE(ecs.HasEntity(id));
+        spawned[int(f)]++;
+    }
+    for (auto count: spawned) {
+        EXPECT_EQ(count, 2);
+    }
+    int negative = 0;
+    ecs.ForEach<const int>([&](const int &i) { negative += i < 0 || i == 0; });
+    EXPECT_EQ(negative, 1001);
 }
 
-TEST(ECS, RemoveComponent) {
+TEST(ECS, OutOfEntityIDs) {
     ecs::ECSManager<int> ecs;
-
     auto entity = ecs.AddEntity();
-    ecs.Add(entity, 5);
-    ASSERT_TRUE(ecs.HasEntity(entity));
-    ASSERT_TRUE(ecs.Has<int>(entity));
-    ecs.Remove<int>(entity);
-    ASSERT_TRUE(ecs.HasEntity(entity));
-    ASSERT_FALSE(ecs.Has<int>(entity));
-
-    ASSERT_THROW(ecs.Remove<int>(entity), std::logic_error);
+    EXPECT_THROW((void)ecs.ReserveEntities(ecs::EntityID::MaxSlots), std::length_error);
+    auto reserved = ecs.ReserveEntity();
+    EXPECT_EQ(reserved.GetId(), entity.GetId() + 1);
+    ecs.CommitReserved();
+    EXPECT_TRUE(ecs.HasEntity(reserved));
 }
 
-TEST(ECS, LoopEntities) {
-    ecs::ECSManager<int, std::string> ecs;
-    {
-        int callCount = 0;
-        for (auto &entity: ecs) {
-            callCount++;
-        }
-        ASSERT_EQ(callCount, 0);
+TEST(ECS, ReservedEntities) {
+    ecs::ECSManager<int> ecs;
+    auto first = ecs.BuildEntity(1);
+    auto last = ecs.BuildEntity(2);
+    ecs.RemoveEntity(last);
+    auto reserved = ecs.ReserveEntity();
+    EXPECT_NE(reserved.GetId(), first.GetId());
+    EXPECT_NE(reserved.GetId(), last.GetId());
+    EXPECT_EQ(ecs.Size(), 1);
+
+    auto added = ecs.AddEntity();
+    EXPECT_EQ(ecs.Size(), 3);
+    EXPECT_TRUE(ecs.HasEntity(reserved));
+    EXPECT_NE(added, reserved);
+    EXPECT_EQ(added.GetId(), last.GetId());
+    EXPECT_FALSE(ecs.HasEntity(last));
+
+    auto more = ecs.ReserveEntities(3);
+    ecs.CommitReserved();
+    EXPECT_EQ(ecs.Size(), 6);
+    for (auto id: more) {
+        EXPECT_TRUE(ecs.HasEntity(id));
+        ecs.Add(id, 5);
     }
+    int sum = 0;
+    ecs.ForEach<int>([&](int &i) { sum += i; });
+    EXPECT_EQ(sum, 16);
+}
 
-    {
-        auto entity = ecs.AddEntity();
-        ecs.Add(entity, 5);
-        int callCount = 0;
-        for (auto &e: ecs) {
-            callCount++;
-            auto [i, str] = e.activeComponents;
-            EXPECT_EQ(e.id, entity);
-            EXPECT_FALSE(str.active);
-            EXPECT_TRUE(i.active);
+TEST(ECS, ReservedEntitiesReuseSlots) {
+    ecs::ECSManager<int> ecs;
+    for (int frame = 0; frame < 1000; frame++) {
+        auto ids = ecs.ReserveEntities(100);
+        ecs.CommitReserved();
+        EXPECT_EQ(ecs.Size(), 100);
+        for (auto id: ids) {
+            EXPECT_TRUE(ecs.HasEntity(id));
+            ecs.RemoveEntity(id);
         }
-        ASSERT_EQ(callCount, 1);
     }
-    {
-        auto entity = ecs.AddEntity();
-        ecs.Add(entity, 2);
-        ecs.Add(entity, std::string("hej"));
+    EXPECT_LE(ecs.ReserveEntity().GetId(), 200);
+    EXPECT_LE(std::distance(ecs.begin(), ecs.end()), 200);
+}
 
-        int callCount = 0;
-        for (auto &e: ecs) {
-            callCount++;
-            if (e.id == entity) {
-                auto [str, i] = e.activeComponents;
-                EXPECT_TRUE(str.active);
-                EXPECT_TRUE(i.active);
-                auto result = ecs.Has<int, std::string>(e.id);
-                EXPECT_TRUE(result);
-            }
-        }
-        ASSERT_EQ(callCount, 2);
-        ecs.RemoveEntity(entity);
-        callCount = 0;
-        for (auto &e: ecs) {
-            callCount++;
-        }
-        ASSERT_EQ(callCount, 1);
-        ASSERT_FALSE(ecs.HasEntity(entity));
+TEST(ECS, RemovedComponentClearsSignature) {
+    ecs::ECSManager<int, std::string, float> ecs;
+    auto entity = ecs.AddEntity();
+    ecs.Add(entity, 1);
+    ecs.Add<std::string>(entity, "a");
+    ecs.Remove<std::string>(entity);
+    EXPECT_TRUE(ecs.Has<int>(entity));
+    EXPECT_FALSE((ecs.Has<int, std::string>(entity)));
+    ecs.RemoveEntity(entity);
+
+    auto reused = ecs.AddEntity();
+    EXPECT_EQ(reused.GetId(), entity.GetId());
+    EXPECT_FALSE(ecs.Has<int>(reused));
+    int count = 0;
+    for (auto [i]: ecs.GetSystem<int>()) {
+        count++;
     }
+    EXPECT_EQ(count, 0);
 }
 
 TEST(ECS, LoopOnceWithFilter) {
@@ -595,6 +1847,71 @@ TEST(ECS, ReuseSlots) {
     }
 }
 
+TEST(ECS, ShrinkEndSlotPastTrailingHoles) {
+    ecs::ECSManager<int> ecs;
+    auto e1 = ecs.BuildEntity(1);
+    auto e2 = ecs.AddEntity();
+    auto e3 = ecs.AddEntity();
+
+    ecs.RemoveEntity(e2);
+    ecs.RemoveEntity(e3);
+    int count = 0;
+    for (auto &e: ecs) {
+        count++;
+    }
+    ASSERT_EQ(count, 1);
+    for (auto [i]: ecs.GetSystem<int>()) {
+        count++;
+    }
+    ASSERT_EQ(count, 2);
+
+    ASSERT_EQ(ecs.AddEntity().GetId(), 1);
+    ASSERT_EQ(ecs.AddEntity().GetId(), 2);
+    ASSERT_EQ(ecs.AddEntity().GetId(), 3);
+    ASSERT_TRUE(ecs.HasEntity(e1));
+}
+
+TEST(ECS, SpawnCostFragmented) {
+    using namespace std::chrono;
+    const size_t worldSize = 200000;
+    const size_t burst = 20000;
+
+    auto timeBurst = [&](ecs::ECSManager<int> &ecs) {
+        std::vector<ecs::EntityID> spawned;
+        auto start = high_resolution_clock::now();
+        for (size_t i = 0; i < burst; i++) {
+            spawned.push_back(ecs.AddEntity());
+        }
+        auto end = high_resolution_clock::now();
+        return std::make_pair(spawned, duration_cast<nanoseconds>(end - start).count());
+    };
+
+    ecs::ECSManager<int> fresh;
+    auto [freshIds, freshDuration] = timeBurst(fresh);
+
+    // Punch a hole in every other slot, the burst has to refill them
+    // lowest slot first.
+    ecs::ECSManager<int> fragmented;
+    std::vector<ecs::EntityID> ids;
+    for (size_t i = 0; i < worldSize; i++) {
+        ids.push_back(fragmented.AddEntity());
+    }
+    for (size_t i = 0; i < worldSize; i += 2) {
+        fragmented.RemoveEntity(ids[i]);
+    }
+    auto [fragmentedIds, fragmentedDuration] = timeBurst(fragmented);
+    for (size_t i = 0; i < burst; i++) {
+        ASSERT_EQ(fragmentedIds[i].GetId(), i * 2);
+    }
+    ASSERT_EQ(fragmented.Size(), worldSize / 2 + burst);
+
+    // Spawning into a fragmented world costs about the same per entity
+    // as spawning into an empty one, scanning for holes used to make it
+    // grow with the world size, thousands of times slower here. The
+    // bound is loose to not be flaky on loaded machines.
+    ASSERT_LT(fragmentedDuration, freshDuration * 20);
+}
+
 TEST(ECS, ConcurencySystem) {
     ecs::ECSManager<int, float> ecs;
     for (int i = 0; i < 1024 - 1; i++) {
@@ -1015,6 +2332,326 @@ TEST(ECS, HasTypes)
     static_assert(not ecs::HasTypes<TEcs, double>());
 }
 
+TEST(ECS, SparseStorage) {
+    ecs::SparseStorage<int> storage;
+    storage.Insert(5000, 1);
+    storage.Insert(3, 2);
+    storage.Insert(10, 3);
+    ASSERT_EQ(storage.Size(), 3);
+    ASSERT_EQ(storage.Get(5000), 1);
+    ASSERT_EQ(storage.Get(3), 2);
+    ASSERT_EQ(storage.Get(10), 3);
+
+    // The last component is swapped into the hole.
+    storage.Erase(5000);
+    ASSERT_EQ(storage.Size(), 2);
+    ASSERT_EQ(storage.Slots(), std::vector<size_t>({10, 3}));
+    ASSERT_EQ(storage.Get(3), 2);
+    ASSERT_EQ(storage.Get(10), 3);
+
+    storage.Erase(10);
+    storage.Erase(3);
+    ASSERT_EQ(storage.Size(), 0);
+    ASSERT_TRUE(storage.Slots().empty());
+}
+
+TEST(ECS, SparseComponent) {
+    static_assert(std::is_same_v<ecs::StorageFor<SparseComponent>, ecs::SparseStorage<SparseComponent>>);
+    static_assert(std::is_same_v<ecs::StorageFor<int>, ecs::DenseStorage<int>>);
+
+    ecs::ECSManager<int, SparseComponent> ecs;
+    std::vector<ecs::EntityID> rare;
+    for (int i = 0; i < 1000; i++) {
+        auto entity = ecs.BuildEntity(i);
+        if (i % 100 == 0) {
+            ecs.Add(entity, SparseComponent{.value = i});
+            rare.push_back(entity);
+        }
+    }
+
+    for (auto entity: rare) {
+        ASSERT_TRUE(ecs.Has<SparseComponent>(entity));
+        ASSERT_EQ(ecs.Get<SparseComponent>(entity).value, ecs.Get<int>(entity));
+    }
+
+    int count = 0;
+    for (auto [sparse, i]: ecs.GetSystem<SparseComponent, int>()) {
+        ASSERT_EQ(sparse.value, i);
+        count++;
+    }
+    ASSERT_EQ(count, 10);
+
+    ecs.Remove<SparseComponent>(rare[0]);
+    ecs.RemoveEntity(rare[1]);
+    ASSERT_FALSE(ecs.Has<SparseComponent>(rare[0]));
+    ASSERT_EQ(ecs.Get<SparseComponent>(rare[9]).value, 900);
+
+    count = 0;
+    for (auto [sparse]: ecs.GetSystem<SparseComponent>()) {
+        sparse.value = -1;
+        count++;
+    }
+    ASSERT_EQ(count, 8);
+    for (size_t i = 2; i < rare.size(); i++) {
+        ASSERT_EQ(ecs.Get<SparseComponent>(rare[i]).value, -1);
+    }
+
+    // A reused slot does not inherit the removed sparse component.
+    auto entity = ecs.AddEntity();
+    ASSERT_EQ(entity.GetId(), rare[1].GetId());
+    ASSERT_FALSE(ecs.Has<SparseComponent>(entity));
+}
+
+TEST(ECS, SparseComponentSystemPart) {
+    ecs::ECSManager<int, SparseComponent> ecs;
+    for (int i = 0; i < 100; i++) {
+        ecs.BuildEntity(i, SparseComponent{.value = i});
+    }
+
+    int maxParts = 7;
+    int n = 0;
+    for (int part = 0; part < maxParts; part++) {
+        for (auto [i, sparse]: ecs.GetSystemPart<int, SparseComponent>(part, maxParts)) {
+            ASSERT_EQ(i, sparse.value);
+            n++;
+        }
+    }
+    ASSERT_EQ(n, 100);
+}
+
+TEST(ECS, TagComponent) {
+    static_assert(std::is_same_v<ecs::StorageFor<TagComponent>, ecs::TagStorage<TagComponent>>);
+    static_assert(std::is_empty_v<ecs::TagStorage<TagComponent>>);
+
+    ecs::ECSManager<int, TagComponent> ecs;
+    auto tagged = ecs.BuildEntity(1, TagComponent{});
+    auto untagged = ecs.BuildEntity(2);
+
+    ASSERT_TRUE(ecs.Has<TagComponent>(tagged));
+    ASSERT_FALSE(ecs.Has<TagComponent>(untagged));
+    EXPECT_THROW(ecs.Add(tagged, TagComponent{}), std::logic_error);
+
+    int count = 0;
+    for (auto [i, tag]: ecs.GetSystem<int, TagComponent>()) {
+        ASSERT_EQ(i, 1);
+        count++;
+    }
+    ASSERT_EQ(count, 1);
+
+    ecs.Remove<TagComponent>(tagged);
+    ASSERT_FALSE(ecs.Has<TagComponent>(tagged));
+    for (auto [i, tag]: ecs.GetSystem<int, TagComponent>()) {
+        count++;
+    }
+    ASSERT_EQ(count, 1);
+}
+
+TEST(ECS, EmptyComponentsAreTags) {
+    struct Enemy {
+    };
+    struct Frozen {
+    };
+    static_assert(ecs::StoragePolicy<Enemy>::value == ecs::StorageType::Tag);
+    static_assert(ecs::StoragePolicy<int>::value == ecs::StorageType::Dense);
+    static_assert(std::is_empty_v<ecs::StorageFor<Enemy>>);
+
+    ecs::ECSManager<int, Enemy, Frozen> ecs;
+    std::vector<ecs::EntityID> enemies;
+    for (int i = 0; i < 10; i++) {
+        auto entity = ecs.BuildEntity(i);
+        if (i % 2 == 0) {
+            ecs.Add(entity, Enemy{});
+            enemies.push_back(entity);
+        }
+    }
+    ecs.Add<Frozen>(enemies[0], {});
+
+    int sum = 0;
+    for (auto [i, enemy]: ecs.GetSystem<int, Enemy>()) {
+        sum += i;
+    }
+    ASSERT_EQ(sum, 20);
+    ASSERT_TRUE((ecs.Has<Enemy, Frozen>(enemies[0])));
+    ASSERT_EQ(&ecs.Get<Enemy>(enemies[0]), &ecs.Get<Enemy>(enemies[1]));
+
+    ecs.Remove<Enemy>(enemies[0]);
+    sum = 0;
+    for (auto [i, enemy]: ecs.GetSystem<int, Enemy>()) {
+        sum += i;
+    }
+    ASSERT_EQ(sum, 20);
+    ASSERT_TRUE(ecs.Has<Frozen>(enemies[0]));
+}
+
+TEST(ECS, SingletonComponent) {
+    static_assert(std::is_same_v<ecs::StorageFor<SingletonComponent>, ecs::SingletonStorage<SingletonComponent>>);
+
+    ecs::ECSManager<int, SingletonComponent> ecs;
+    auto e1 = ecs.BuildEntity(1);
+    auto e2 = ecs.BuildEntity(2);
+    EXPECT_THROW(auto &ret = ecs.GetSingleton<SingletonComponent>(), std::invalid_argument);
+
+    ecs.Add(e2, SingletonComponent{.value = 42});
+    EXPECT_THROW(ecs.Add(e1, SingletonComponent{}), std::logic_error);
+    ASSERT_FALSE(ecs.Has<SingletonComponent>(e1));
+    ASSERT_TRUE(ecs.Has<SingletonComponent>(e2));
+    ASSERT_EQ(ecs.GetSingleton<SingletonComponent>().value, 42);
+    ASSERT_EQ(ecs.Get<SingletonComponent>(e2).value, 42);
+
+    int count = 0;
+    for (auto [i, singleton]: ecs.GetSystem<int, SingletonComponent>()) {
+        ASSERT_EQ(i, 2);
+        singleton.value = 7;
+        count++;
+    }
+    ASSERT_EQ(count, 1);
+    ASSERT_EQ(ecs.GetSingleton<SingletonComponent>().value, 7);
+
+    // Ownership can move to another entity once released.
+    ecs.RemoveEntity(e2);
+    ecs.Add(e1, SingletonComponent{.value = 1});
+    ASSERT_EQ(ecs.GetSingleton<SingletonComponent>().value, 1);
+    ASSERT_TRUE(ecs.Has<SingletonComponent>(e1));
+}
+
+TEST(ArchetypeECS, AddAndGet) {
+    ecs::ArchetypeECSManager<int, float, std::string> ecs;
+
+    auto entity = ecs.AddEntity();
+    auto entity2 = ecs.BuildEntity(2, std::string("two"));
+    ASSERT_EQ(ecs.Size(), 2);
+    ASSERT_TRUE(ecs.HasEntity(entity));
+    ASSERT_FALSE(ecs.Has<int>(entity));
+
+    ecs.Add(entity, 1);
+    ecs.Add(entity, 1.5f);
+    EXPECT_THROW(ecs.Add(entity, 3), std::logic_error);
+    ASSERT_TRUE((ecs.Has<int, float>(entity)));
+    ASSERT_FALSE(ecs.Has<std::string>(entity));
+    ASSERT_EQ(ecs.Get<int>(entity), 1);
+    ASSERT_FLOAT_EQ(ecs.Get<float>(entity), 1.5f);
+    EXPECT_THROW(auto ret = ecs.Get<std::string>(entity), std::invalid_argument);
+
+    ASSERT_EQ(ecs.Get<int>(entity2), 2);
+    ASSERT_EQ(ecs.Get<std::string>(entity2), "two");
+
+    // Moving between tables keeps the values of the other components.
+    ecs.Remove<int>(entity);
+    ASSERT_FALSE(ecs.Has<int>(entity));
+    ASSERT_FLOAT_EQ(ecs.Get<float>(entity), 1.5f);
+    EXPECT_THROW(ecs.Remove<int>(entity), std::logic_error);
+}
+
+TEST(ArchetypeECS, RemoveEntity) {
+    ecs::ArchetypeECSManager<int, float> ecs;
+    auto e1 = ecs.BuildEntity(1, 1.0f);
+    auto e2 = ecs.BuildEntity(2, 2.0f);
+    auto e3 = ecs.BuildEntity(3, 3.0f);
+
+    // e3 is swapped into the row of e1.
+    ecs.RemoveEntity(e1);
+    ASSERT_EQ(ecs.Size(), 2);
+    ASSERT_FALSE(ecs.HasEntity(e1));
+    ASSERT_EQ(ecs.Get<int>(e2), 2);
+    ASSERT_EQ(ecs.Get<int>(e3), 3);
+    EXPECT_THROW(ecs.RemoveEntity(e1), std::logic_error);
+
+    auto e4 = ecs.BuildEntity(4);
+    ASSERT_EQ(e4.GetId(), e1.GetId());
+    ASSERT_FALSE(ecs.HasEntity(e1));
+    ASSERT_FALSE(ecs.Has<int>(e1));
+    ASSERT_EQ(ecs.Get<int>(e4), 4);
+}
+
+TEST(ArchetypeECS, SystemOnlyVisitsMatchingTables) {
+    ecs::ArchetypeECSManager<int, float, std::string> ecs;
+    for (int i = 0; i < 10; i++) {
+        ecs.BuildEntity(i);
+        ecs.BuildEntity(i, 1.0f);
+        ecs.BuildEntity(i, 1.0f, std::string("hej"));
+        ecs.BuildEntity(std::string("hej"));
+    }
+    ASSERT_EQ(ecs.ArchetypeCount(), 5);
+
+    int count = 0;
+    int sum = 0;
+    for (auto [i, f]: ecs.GetSystem<int, float>()) {
+        sum += i;
+        f = 2.0f;
+        count++;
+    }
+    ASSERT_EQ(count, 20);
+    ASSERT_EQ(sum, 90);
+
+    count = 0;
+    for (auto [str]: ecs.GetSystem<std::string>()) {
+        count++;
+    }
+    ASSERT_EQ(count, 20);
+
+    // Tables created after the query was first run are picked up.
+    auto entity = ecs.BuildEntity(1.0f);
+    ecs.Add(entity, std::string("new"));
+    count = 0;
+    for (auto [str, f]: ecs.GetSystem<std::string, float>()) {
+        count++;
+    }
+    ASSERT_EQ(count, 11);
+
+    count = 0;
+    for (auto [f]: ecs.GetSystem<float>()) {
+        ASSERT_TRUE(f == 2.0f || f == 1.0f);
+        count++;
+    }
+    ASSERT_EQ(count, 21);
+}
+
+TEST(ArchetypeECS, EmptyComponentsAreTags) {
+    struct Enemy {
+    };
+    ecs::ArchetypeECSManager<int, Enemy> ecs;
+    auto e1 = ecs.BuildEntity(1, Enemy{});
+    auto e2 = ecs.BuildEntity(2);
+    ecs.Add(e2, Enemy{});
+    ecs.BuildEntity(3);
+
+    int sum = 0;
+    for (auto [i, enemy]: ecs.GetSystem<int, Enemy>()) {
+        sum += i;
+    }
+    ASSERT_EQ(sum, 3);
+    ASSERT_EQ(&ecs.Get<Enemy>(e1), &ecs.Get<Enemy>(e2));
+
+    ecs.Remove<Enemy>(e1);
+    ASSERT_FALSE(ecs.Has<Enemy>(e1));
+    ASSERT_EQ(ecs.Get<int>(e1), 1);
+}
+
+struct DenseMarker {
+};
+
+template<>
+struct ecs::StoragePolicy<DenseMarker> {
+    static constexpr ecs::StorageType value = ecs::StorageType::Dense;
+};
+
+TEST(ArchetypeECS, StoragePolicies) {
+    ecs::ArchetypeECSManager<int, DenseMarker, TagComponent, SingletonComponent, std::unique_ptr<int>> ecs;
+    auto e1 = ecs.BuildEntity(1, DenseMarker{}, TagComponent{}, SingletonComponent{1});
+    auto e2 = ecs.BuildEntity(2, DenseMarker{}, TagComponent{});
+    EXPECT_NE(&ecs.Get<DenseMarker>(e1), &ecs.Get<DenseMarker>(e2));
+    EXPECT_EQ(&ecs.Get<TagComponent>(e1), &ecs.Get<TagComponent>(e2));
+
+    EXPECT_THROW(ecs.Add(e2, SingletonComponent{2}), std::logic_error);
+    EXPECT_THROW(ecs.BuildEntity(3, SingletonComponent{3}), std::logic_error);
+    ecs.Remove<SingletonComponent>(e1);
+    ecs.Add(e2, SingletonComponent{2});
+    EXPECT_EQ(ecs.Get<SingletonComponent>(e2).value, 2);
+
+    ecs.Add(e1, std::make_unique<int>(5));
+    EXPECT_EQ(*ecs.Get<std::unique_ptr<int>>(e1), 5);
+}
+
 int main(int argc, char **argv) {
     ::testing::InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();